@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "block.h"
+
+// TraceOperation is the kind of a recorded call.
+enum class TraceOperation : uint8_t {
+    NEW,
+    FREE
+};
+
+// TraceRecord is a single entry of the binary trace log.
+struct TraceRecord {
+    // Timestamp is the number of nanoseconds since the start of the trace.
+    uint64_t Timestamp;
+
+    // Size is the requested size of a New call.
+    uint64_t Size;
+
+    // Id identifies a live block. Ids of freed blocks are reused, so they
+    // stay below the biggest number of live blocks. Failed allocations get
+    // kNoId.
+    uint32_t Id;
+
+    // Thread is a sequential number of the calling thread.
+    uint16_t Thread;
+
+    TraceOperation Operation;
+
+    // AlignmentLog2 is the log2 of the alignment requested by AlignedNew or
+    // Realloc. It's 0 for the machine word alignment of New.
+    uint8_t AlignmentLog2;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord should stay compact");
+
+// AllocationTrace records New and Free calls of an Allocator to a binary log:
+// an 8 bytes magic followed by TraceRecords. Records are written in the order
+// of the calls, so the log is a valid serial replay order.
+// It isn't thread safe, the Allocator records calls under its mutex.
+class AllocationTrace {
+public:
+    static constexpr uint32_t kNoId = UINT32_MAX;
+
+    // Magic starts every trace file.
+    static constexpr char kMagic[8] = {'F', 'L', 'A', 'T', 'R', 'A', 'C', '1'};
+
+    AllocationTrace(const std::string& path) noexcept;
+    ~AllocationTrace() noexcept;
+
+    // IsOpen reports if the trace file was created.
+    bool IsOpen() const noexcept;
+
+    void RecordNew(const MachineWord *data, size_t size) noexcept;
+    void RecordNew(const MachineWord *data, size_t size, size_t alignment) noexcept;
+    void RecordFree(const MachineWord *data) noexcept;
+
+    // Disable move and copy semantics.
+    AllocationTrace(const AllocationTrace&) = delete;
+    AllocationTrace(AllocationTrace&&) = delete;
+    AllocationTrace& operator=(const AllocationTrace&) = delete;
+    AllocationTrace& operator=(AllocationTrace&&) = delete;
+private:
+    FILE *file_;
+    std::chrono::steady_clock::time_point start_;
+
+    // ids maps addresses of the live blocks to their ids, free_ids contains
+    // ids of the freed blocks and next_id is the first id never used.
+    std::unordered_map<const MachineWord *, uint32_t> ids_;
+    std::vector<uint32_t> free_ids_;
+    uint32_t next_id_;
+
+    static uint16_t ThreadNumber() noexcept;
+
+    void Write(TraceOperation operation, uint32_t id, size_t size, uint8_t alignment_log2) noexcept;
+};
+
+bool ReadTrace(const std::string& path, std::vector<TraceRecord>& records) noexcept;
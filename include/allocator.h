@@ -1,62 +1,526 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string>
+#include <atomic>
 #include <mutex>
 
+#include "allocation_trace.h"
 #include "block.h"
 
-class Allocator {
+class CachingAllocator;
+
+enum class AllocationAlgorithm {
+    FIRST_FIT,
+    NEXT_FIT,
+    BEST_FIT,
+    SEGREGATED_FIT,
+    EXPLICIT_FIT,
+
+    // TLSF_FIT is a best fit over a two-level segregated fit index of the
+    // free blocks. It finds a block in constant time.
+    TLSF_FIT
+};
+
+// BackendType selects the way memory is requested from the OS.
+enum class BackendType {
+    // SBRK moves the end of the process heap. Only one allocator can use
+    // it at a time and it can't be used with other sbrk users like malloc.
+    SBRK,
+
+    // MMAP maps independent arenas, any number of allocators can use it.
+    MMAP,
+
+    // BUFFER serves blocks from a buffer provided by the caller and never
+    // calls the OS: New returns a nullptr when the buffer is used up. Slab
+    // tier, huge objects and trimming are disabled.
+    BUFFER
+};
+
+// Fit policies of BasicAllocator. DynamicFit takes the algorithm from the
+// constructor, StaticFit fixes it at compile time, so the fit is dispatched
+// without a switch and the other fits aren't instantiated on the hot path.
+struct DynamicFit {
+    static constexpr bool kDynamic = true;
+    static constexpr AllocationAlgorithm kAlgorithm = AllocationAlgorithm::FIRST_FIT;
+};
+
+template <AllocationAlgorithm algorithm>
+struct StaticFit {
+    static constexpr bool kDynamic = false;
+    static constexpr AllocationAlgorithm kAlgorithm = algorithm;
+};
+
+using FirstFitPolicy = StaticFit<AllocationAlgorithm::FIRST_FIT>;
+using NextFitPolicy = StaticFit<AllocationAlgorithm::NEXT_FIT>;
+using BestFitPolicy = StaticFit<AllocationAlgorithm::BEST_FIT>;
+using SegregatedFitPolicy = StaticFit<AllocationAlgorithm::SEGREGATED_FIT>;
+using ExplicitFitPolicy = StaticFit<AllocationAlgorithm::EXPLICIT_FIT>;
+using TlsfFitPolicy = StaticFit<AllocationAlgorithm::TLSF_FIT>;
+
+// Backing policies of BasicAllocator. DynamicBacking takes the backend from
+// Options, StaticBacking fixes it at compile time and overrides Options.
+struct DynamicBacking {
+    static constexpr bool kDynamic = true;
+    static constexpr BackendType kBackend = BackendType::SBRK;
+};
+
+template <BackendType backend>
+struct StaticBacking {
+    static constexpr bool kDynamic = false;
+    static constexpr BackendType kBackend = backend;
+};
+
+using SbrkBacking = StaticBacking<BackendType::SBRK>;
+using MmapBacking = StaticBacking<BackendType::MMAP>;
+using BufferBacking = StaticBacking<BackendType::BUFFER>;
+
+// Lock policies of BasicAllocator: std::mutex, SpinLock or NoLock. Any type
+// with lock, unlock and try_lock can be used.
+
+// SpinLock spins on an atomic flag. It suits short critical sections of
+// allocators that are rarely contended. Waiting threads yield the CPU, so a
+// preempted holder can finish.
+class SpinLock {
+public:
+    void lock() noexcept;
+    void unlock() noexcept;
+    bool try_lock() noexcept;
+private:
+    std::atomic<bool> locked_{false};
+};
+
+// NoLock doesn't lock anything. It's meant for allocators used by a single
+// thread, Free of such allocator never takes the remote free list.
+struct NoLock {
+    void lock() noexcept;
+    void unlock() noexcept;
+    bool try_lock() noexcept;
+};
+
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+class BasicAllocator;
+
+// Allocator selects the fit and the backend at runtime and locks a mutex.
+using Allocator = BasicAllocator<DynamicFit, std::mutex, DynamicBacking>;
+
+// BasicAllocator is the free list allocator with the fit, the lock and the OS
+// backend given as policies.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+class BasicAllocator {
+    // CachingAllocator refills and flushes its caches in batches under a single
+    // lock of the mutex.
+    friend class CachingAllocator;
 public:
-    mutable std::mutex _mtx;
+    mutable LockPolicy _mtx;
+
+    using AllocationAlgorithm = ::AllocationAlgorithm;
+    using BackendType = ::BackendType;
+
+    struct Options {
+        BackendType Backend = BackendType::SBRK;
+
+        // ArenaSize is the size of the first arena mapped by the MMAP backend.
+        // Bigger blocks get their own arenas.
+        size_t ArenaSize = 1 << 20;
+
+        // GrowthSize is the smallest number of bytes added to the SBRK heap
+        // when it grows. The part that isn't needed is left as a free block.
+        // Zero grows the heap by exactly one block.
+        size_t GrowthSize = 0;
+
+        // GrowthFactor multiplies the growth size (or the arena size) after
+        // every growth until it reaches MaxGrowthSize.
+        size_t GrowthFactor = 2;
+        size_t MaxGrowthSize = 64 << 20;
+
+        // SlabMaxSize is the biggest size served by the slab tier, up to 128
+        // bytes. Zero disables the tier.
+        size_t SlabMaxSize = 0;
+
+        // SlabArenaSize is the size of the address range reserved for slabs.
+        // Allocations fall back to the blocks when it's used up.
+        size_t SlabArenaSize = 64 << 20;
+
+        // TrimThreshold is the smallest free block that is trimmed right
+        // after Free. Zero trims only on the Trim calls.
+        size_t TrimThreshold = 0;
+
+        // HugeThreshold is the smallest size of an object that gets its own
+        // mapping. It's unmapped right in Free, so big buffers don't split
+        // and pin the heap. Zero serves all sizes from the heap.
+        size_t HugeThreshold = 0;
+
+        // HugeObjectPages maps huge objects with MAP_HUGETLB if the system has
+        // reserved huge pages and asks for transparent huge pages otherwise.
+        bool HugeObjectPages = false;
+
+        // HugePageRegions maps MMAP arenas and the slab arena at the huge page
+        // boundaries in whole huge pages and advises them with MADV_HUGEPAGE,
+        // so the heap takes fewer TLB entries. Small objects of the slab tier
+        // are packed in the same huge pages. SBRK heap isn't affected.
+        bool HugePageRegions = false;
+
+        // RegionHook is called with RegionHookContext when the allocator maps
+        // or unmaps an address range: MMAP arenas, the slab arena and huge
+        // objects. It's called under the allocator mutex and before the pages
+        // of a new range are touched. ArenaAllocator uses it to find the
+        // allocator of a block and to bind the range to a NUMA node.
+        void (*RegionHook)(void *context, BasicAllocator *allocator, void *start, size_t size, bool mapped) = nullptr;
+        void *RegionHookContext = nullptr;
+    };
+
+    // Number of size classes in Stats: one per machine word multiple up to 128
+    // bytes and one per power of two above that.
+    static constexpr size_t kStatsClassCount = 64;
+
+    // Stats describes the state of the heap. Counters are kept up to date on
+    // every New and Free.
+    struct Stats {
+        // HeapSize is the number of bytes taken from the OS, AllocatedSize is
+        // the data size of the live blocks and slab objects.
+        size_t HeapSize;
+        size_t AllocatedSize;
+
+        // FreeSize is the data size of the free blocks.
+        size_t FreeSize;
+
+        size_t UsedBlocks;
+        size_t FreeBlocks;
+        size_t LargestFreeBlock;
+
+        // Fragmentation is the part of the free space that can't be used by
+        // the biggest allocation: 1 - LargestFreeBlock / FreeSize.
+        double Fragmentation;
+
+        // SizeClasses contains the number of live blocks in every size class.
+        size_t SizeClasses[kStatsClassCount];
 
-    enum class AllocationAlgorithm {
-        FIRST_FIT,
-        NEXT_FIT,
-        BEST_FIT
+        // Searches is the number of free block searches and SearchSteps is the
+        // number of blocks they visited.
+        size_t Searches;
+        size_t SearchSteps;
+        double AverageSearchLength;
+
+        // HugeObjects is the number of objects with their own mappings and
+        // HugeSize is the size of the mappings. They are a part of the used
+        // blocks and the heap size.
+        size_t HugeObjects;
+        size_t HugeSize;
+
+        // HugePageSize is the part of the heap in huge pages: regions advised
+        // with MADV_HUGEPAGE and huge objects in reserved huge pages. The OS
+        // backs the advised regions with huge pages when it has them.
+        size_t HugePageSize;
     };
 
-    Allocator(AllocationAlgorithm algorithm) noexcept;
-    ~Allocator() noexcept;
+    BasicAllocator(AllocationAlgorithm algorithm) noexcept;
+    BasicAllocator(AllocationAlgorithm algorithm, const Options& options) noexcept;
+
+    // Constructors of the static fit policies. Static fit and backing
+    // policies take precedence over the algorithm and Options.Backend.
+    BasicAllocator() noexcept;
+    BasicAllocator(const Options& options) noexcept;
+
+    // Constructors of the BUFFER backend. The allocator manages the size
+    // bytes of the buffer, for example a stack array, a shared memory segment
+    // or a pre-faulted mapping, and doesn't free it. Options.Backend is
+    // ignored. Static backing policies other than BufferBacking don't
+    // compile with them.
+    BasicAllocator(AllocationAlgorithm algorithm, void *buffer, size_t size) noexcept;
+    BasicAllocator(AllocationAlgorithm algorithm, void *buffer, size_t size, const Options& options) noexcept;
+    ~BasicAllocator() noexcept;
 
     std::string Algorithm() const noexcept;
 
     static size_t Align(size_t initial_size) noexcept;
 
     MachineWord *New(size_t size) noexcept;
+
+    // Free returns the data to the heap. If another thread holds the lock,
+    // the data is pushed to the remote free list instead and the next holder
+    // of the lock frees it.
     void Free(MachineWord *data) noexcept;
 
+    // NewBatch allocates count blocks of the same size under a single lock
+    // and returns the number of allocated blocks. Blocks are carved from a
+    // single free block when it's possible.
+    size_t NewBatch(size_t size, size_t count, MachineWord **data) noexcept;
+
+    // FreeBatch frees count blocks under a single lock. It sorts the data by
+    // address so adjacent blocks are merged in a single pass.
+    void FreeBatch(MachineWord **data, size_t count) noexcept;
+
+    // Realloc changes the size of the data and returns its new address. The
+    // data is moved only if the block can't be resized in place.
+    MachineWord *Realloc(MachineWord *data, size_t size) noexcept;
+
+    // Realloc with the alignment allocates moved data with AlignedNew, so the
+    // data keeps the alignment after the move.
+    MachineWord *Realloc(MachineWord *data, size_t size, size_t alignment) noexcept;
+
+    // AlignedNew returns data aligned to the alignment, a power of two. It
+    // returns a nullptr for other alignments. Data is freed with Free.
+    MachineWord *AlignedNew(size_t size, size_t alignment) noexcept;
+
+    size_t UsableSize(const MachineWord *data) const noexcept;
+
+    // HeapSize returns the number of bytes taken from the OS.
+    size_t HeapSize() const noexcept;
+
+    // GetStats returns the state of the heap. Data on the remote free list
+    // is counted as used until the next New or Free takes it.
+    Stats GetStats() const noexcept;
+
+    // Trim returns free memory to the OS and returns the number of released
+    // bytes. Free space at the end of the heap and free arenas are given
+    // back, pages inside other free blocks are dropped with madvise.
+    size_t Trim() noexcept;
+
+    // SetTrace starts recording New and Free calls to the trace, a nullptr
+    // stops it. The trace should outlive the recording.
+    void SetTrace(AllocationTrace *trace) noexcept;
+
     // Disable move and copy semantics.
-    Allocator(const Allocator&) = delete;
-    Allocator(Allocator&&) = delete;
-    Allocator& operator=(const Allocator&) = delete;
-    Allocator& operator=(Allocator&&) = delete;
+    BasicAllocator(const BasicAllocator&) = delete;
+    BasicAllocator(BasicAllocator&&) = delete;
+    BasicAllocator& operator=(const BasicAllocator&) = delete;
+    BasicAllocator& operator=(BasicAllocator&&) = delete;
 private:
+    // Number of exact size classes used by the segregated fit: one class per
+    // machine word multiple up to 128 bytes.
+    static constexpr size_t kExactBinCount = 16;
+
+    // Total number of size classes. Classes above the exact ones cover power of
+    // two ranges, the last one keeps everything that is bigger.
+    static constexpr size_t kBinCount = 64;
+
+    // The two-level segregated fit splits every power of two range of sizes
+    // into 2^kTlsfSecondLevelLog2 classes. Sizes below kTlsfSmallSize share
+    // the first level and have exact classes.
+    static constexpr size_t kTlsfSecondLevelLog2 = 4;
+    static constexpr size_t kTlsfSecondLevelCount = 1 << kTlsfSecondLevelLog2;
+    static constexpr size_t kTlsfSmallSize = kTlsfSecondLevelCount * sizeof(MachineWord);
+
+    // Number of the first level classes: block sizes fit into 61 bits and
+    // the sizes up to 2^7 share the first class.
+    static constexpr size_t kTlsfFirstLevelCount = 61 - 7 + 1;
+
+    // Number of free lists used by any algorithm.
+    static constexpr size_t kFreeListCount = kTlsfFirstLevelCount * kTlsfSecondLevelCount;
+
+    // Number of slab size classes: one per machine word multiple up to 128
+    // bytes.
+    static constexpr size_t kSlabClassCount = 16;
+
+    // Size of the slab header. Objects after it are aligned to 64 bytes
+    // boundary.
+    static constexpr size_t kSlabHeaderSize = 64;
+
+    // Size of a huge page used for the huge object mappings.
+    static constexpr size_t kHugePageSize = 2 << 20;
+
+    // Arena is a header of a memory region mapped by the MMAP backend. Blocks
+    // of the arena follow its header.
+    struct Arena {
+        Arena *Next;
+        size_t Size;
+
+        // HugePageSize is the size of the arena if it's advised for huge
+        // pages and zero otherwise.
+        size_t HugePageSize;
+    };
+
+    // Slab is a header of a page that keeps objects of a single size. Objects
+    // don't have headers, their slab is found from the page address.
+    struct Slab {
+        // Links of the list of slabs with free objects of the same size.
+        Slab *Next;
+        Slab *Prev;
+
+        // FreeObjects is a list of free objects chained by their first word.
+        MachineWord *FreeObjects;
+
+        size_t ObjectSize;
+        size_t UsedCount;
+    };
+
+    // HugeObject is a header of the mapping of a huge object. The block
+    // header of the object follows it, has the Fence flag set and keeps the
+    // distance to the start of the mapping in PrevSize.
+    struct HugeObject {
+        // Links of the list of huge objects.
+        HugeObject *Next;
+        HugeObject *Prev;
+
+        // Size of the mapping and of its pages.
+        size_t Size;
+        size_t PageSize;
+    };
+
     AllocationAlgorithm algorithm_;
+    Options options_;
 
     // heap_start contains pointer to the start of the heap and it is only updated
     // on the very first allocation.
     MemoryBlock *heap_start_;
 
-    // heap_end points to the current end of the heap and it's updated on the new
-    // allocation from the OS.
+    // heap_end points to the fence of the last memory region and it's updated
+    // on the new allocation from the OS.
     MemoryBlock *heap_end_;
 
     // next_fit_start_block points to the block that should be used in the NextFit.
     MemoryBlock *next_fit_start_block_;
 
+    // free_bins contains heads of the free lists for every size class. It is
+    // used only by the algorithms that keep explicit free lists. The explicit
+    // fit keeps all free blocks in the first list, the segregated fit uses the
+    // first kBinCount lists.
+    MemoryBlock *free_bins_[kFreeListCount];
+
+    // bin_map has a bit set for every non-empty free_bins entry of the
+    // segregated fit.
+    uint64_t bin_map_;
+
+    // tlsf_first_map has a bit set for every first level class of the TLSF
+    // index with a non-empty second level class, tlsf_second_maps have a bit
+    // set for every non-empty free list.
+    uint64_t tlsf_first_map_;
+    uint32_t tlsf_second_maps_[kTlsfFirstLevelCount];
+
+    // arenas contains the list of arenas mapped by the MMAP backend.
+    Arena *arenas_;
+
+    // growth_size is the number of bytes that is requested from the OS on the
+    // next heap growth.
+    size_t growth_size_;
+
+    // heap_size is the number of bytes taken from the OS.
+    size_t heap_size_;
+
+    // Counters of the used and free blocks and of the free block searches
+    // reported by GetStats.
+    size_t allocated_size_;
+    size_t free_size_;
+    size_t used_blocks_;
+    size_t free_blocks_;
+    size_t size_classes_[kStatsClassCount];
+    size_t searches_;
+    size_t search_steps_;
+
+    // remote_frees is a lock-free list of data freed while another thread
+    // held the lock, chained by the first word of the data. Any number of
+    // threads push to it and the holder of the lock takes the whole list.
+    std::atomic<MachineWord *> remote_frees_;
+
+    // trace records New and Free calls if it's set. It's changed under the
+    // lock, CachingAllocator checks it without the lock.
+    std::atomic<AllocationTrace *> trace_;
+
+    // slab_arena is the address range reserved for slabs, slab_arena_used is
+    // the number of bytes already given to the slabs. Every slab takes a
+    // single page.
+    char *slab_arena_;
+    size_t slab_arena_used_;
+    size_t page_size_;
+
+    // slab_huge_pages reports if the slab arena is advised for huge pages.
+    bool slab_huge_pages_;
+
+    // slab_classes contains lists of slabs with free objects for every slab
+    // size class, free_slabs contains slabs without objects.
+    Slab *slab_classes_[kSlabClassCount];
+    Slab *free_slabs_;
+
+    // huge_objects contains the list of huge object mappings, huge_size is
+    // their total size.
+    HugeObject *huge_objects_;
+    size_t huge_objects_count_;
+    size_t huge_size_;
+
+    // huge_page_size is the size of the arenas and huge objects in huge pages.
+    size_t huge_page_size_;
+
+    // buffer is the aligned buffer of the BUFFER backend until it's turned
+    // into the heap region on the first allocation.
+    char *buffer_;
+    size_t buffer_size_;
+
+    // ActiveAlgorithm and ActiveBackend return the fit and the backend. They
+    // are constants with the static policies.
+    AllocationAlgorithm ActiveAlgorithm() const noexcept;
+    BackendType ActiveBackend() const noexcept;
+
+    static Options BufferOptions(const Options& options) noexcept;
+
+    MachineWord *NewLocked(size_t size) noexcept;
+    MachineWord *NewBlock(size_t size) noexcept;
+    MachineWord *AlignedNewLocked(size_t size, size_t alignment) noexcept;
+    MachineWord *ReallocLocked(MachineWord *data, size_t size, size_t alignment) noexcept;
+    size_t NewBatchLocked(size_t size, size_t count, MachineWord **data) noexcept;
+    void FreeBatchLocked(MachineWord **data, size_t count) noexcept;
+    void FreeLocked(MachineWord *data) noexcept;
+    void PushRemoteFrees(MachineWord *first, MachineWord *last) noexcept;
+    void DrainRemoteFrees() noexcept;
+
+    size_t AllocationSize(size_t needed_size) const noexcept;
+
     static size_t AllocSizeWithBlock(size_t size) noexcept;
+    static size_t BinIndex(size_t size) noexcept;
+    static size_t TlsfIndex(size_t size) noexcept;
+
+    bool UsesFreeLists() const noexcept;
+    size_t FreeListIndex(size_t size) const noexcept;
+    size_t MinBlockSize() const noexcept;
+
+    void InsertFreeBlock(MemoryBlock *memory_block) noexcept;
+    void RemoveFreeBlock(MemoryBlock *memory_block) noexcept;
 
     MemoryBlock *FindBlock(size_t size) noexcept;
 
-    static MemoryBlock *NewFromOS(size_t size) noexcept;
+    MemoryBlock *NewFromOS(size_t size) noexcept;
+    MemoryBlock *GrowHeap(size_t size) noexcept;
+    size_t NextGrowthSize(size_t needed_size) noexcept;
+    MemoryBlock *MapArena(size_t size) noexcept;
+    MemoryBlock *UseBuffer(size_t size) noexcept;
+    MemoryBlock *NewRegion(void *start, size_t region_size) noexcept;
+    void UnmapArenas() noexcept;
+    void NotifyRegion(void *start, size_t size, bool mapped) noexcept;
+    void *MapRegion(size_t size, int flags, bool& huge_pages) noexcept;
 
-    static void SplitBlock(MemoryBlock *memory_block, size_t size) noexcept;
+    size_t TrimBlock(MemoryBlock *memory_block) noexcept;
+    size_t ShrinkHeap(MemoryBlock *memory_block) noexcept;
+    size_t ReleaseArena(MemoryBlock *memory_block) noexcept;
+    size_t ReleasePages(MemoryBlock *memory_block) noexcept;
+
+    void SplitBlock(MemoryBlock *memory_block, size_t size) noexcept;
     void MergeBlocks(MemoryBlock *memory_block) noexcept;
 
-    void ListAllocate(MemoryBlock *memory_block, size_t size) const noexcept;
+    void ListAllocate(MemoryBlock *memory_block, size_t size) noexcept;
+    void ShrinkBlock(MemoryBlock *memory_block, size_t size) noexcept;
+    void ExtendBlock(MemoryBlock *memory_block) noexcept;
+    size_t LargestFreeBlock() const noexcept;
+
+    bool IsSlabObject(const MachineWord *data) const noexcept;
+    Slab *GetSlab(const MachineWord *data) const noexcept;
+    Slab *NewSlab(size_t size) noexcept;
+    MachineWord *SlabNew(size_t size) noexcept;
+    void SlabFree(MachineWord *data) noexcept;
+    void RemoveSlab(Slab *slab) noexcept;
+
+    bool IsHugeSize(size_t needed_size) const noexcept;
+    void *MapHuge(size_t size, size_t& page_size) noexcept;
+    MachineWord *NewHuge(size_t size, size_t alignment) noexcept;
+    MachineWord *ReallocHuge(MemoryBlock *memory_block, size_t size) noexcept;
+    void FreeHuge(MemoryBlock *memory_block) noexcept;
+    void LinkHuge(HugeObject *huge_object) noexcept;
+    void UnlinkHuge(HugeObject *huge_object) noexcept;
 
-    MemoryBlock *FirstFit(size_t size) const noexcept;
+    MemoryBlock *FirstFit(size_t size) noexcept;
     MemoryBlock *NextFit(size_t size) noexcept;
-    MemoryBlock *BestFit(size_t size) const noexcept;
+    MemoryBlock *BestFit(size_t size) noexcept;
+    MemoryBlock *SegregatedFit(size_t size) noexcept;
+    MemoryBlock *ExplicitFit(size_t size) noexcept;
+    MemoryBlock *TlsfFit(size_t size) noexcept;
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "allocator.h"
+
+// ArenaAllocator spreads threads over a number of independent Allocators, so
+// threads of different arenas don't share a lock or a heap. Every arena maps
+// its own regions with the MMAP backend. Free finds the arena of a block from
+// its address in a page map, so blocks can be freed by any thread.
+class ArenaAllocator {
+public:
+    // ArenaAssignment selects the arena of the calling thread.
+    enum class ArenaAssignment {
+        // ROUND_ROBIN gives every new thread the next arena.
+        ROUND_ROBIN,
+
+        // CPU picks the arena of the CPU the thread runs on at the call.
+        CPU,
+
+        // NUMA_NODE keeps an arena per NUMA node bound to the node memory and
+        // picks the arena of the node the thread runs on at the call. If the
+        // machine has fewer nodes than arenas, the nodes are simulated: threads
+        // are spread over them round robin and the memory isn't bound.
+        NUMA_NODE
+    };
+
+    // Options of all arenas. The backend is always MMAP and the region hook
+    // is taken by the ArenaAllocator. Zero arena_count with NUMA_NODE creates
+    // an arena per node of the machine.
+    ArenaAllocator(Allocator::AllocationAlgorithm algorithm, size_t arena_count,
+        ArenaAssignment assignment = ArenaAssignment::ROUND_ROBIN,
+        const Allocator::Options& options = Allocator::Options()) noexcept;
+    ~ArenaAllocator() noexcept;
+
+    // New allocates from the arena of the calling thread and tries the other
+    // arenas if it's out of memory.
+    MachineWord *New(size_t size) noexcept;
+    void Free(MachineWord *data) noexcept;
+    MachineWord *AlignedNew(size_t size, size_t alignment) noexcept;
+    MachineWord *Realloc(MachineWord *data, size_t size) noexcept;
+    size_t UsableSize(const MachineWord *data) const noexcept;
+
+    size_t ArenaCount() const noexcept;
+    Allocator& Arena(size_t index) noexcept;
+
+    // Owner returns the arena the data was allocated from or a nullptr.
+    Allocator *Owner(const MachineWord *data) const noexcept;
+
+    // SimulatedNodes reports if the NUMA nodes of the arenas are simulated.
+    bool SimulatedNodes() const noexcept;
+
+    // SystemNodeCount returns the number of NUMA nodes of the machine.
+    static size_t SystemNodeCount() noexcept;
+
+    // PageMapSize returns the number of bytes taken by the page map.
+    size_t PageMapSize() const noexcept;
+
+    // Disable move and copy semantics.
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator(ArenaAllocator&&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(ArenaAllocator&&) = delete;
+private:
+    // Page map covers 48 bit addresses in 4 KiB pages with three levels of
+    // 4096 entries. Regions are page aligned, so every page has at most one
+    // owner.
+    static constexpr size_t kPageMapPageShift = 12;
+    static constexpr size_t kPageMapLevelBits = 12;
+    static constexpr size_t kPageMapLevelSize = 1 << kPageMapLevelBits;
+
+    // PageMapLeaf keeps the owners of 4096 pages, 16 MiB of addresses.
+    struct PageMapLeaf {
+        std::atomic<Allocator *> Owners[kPageMapLevelSize];
+    };
+
+    // PageMapNode keeps the leaves of 64 GiB of addresses.
+    struct PageMapNode {
+        std::atomic<PageMapLeaf *> Leaves[kPageMapLevelSize];
+    };
+
+    ArenaAssignment assignment_;
+    bool simulated_nodes_;
+
+    // page_map is a radix tree from the page address to its arena. Nodes and
+    // leaves are added when a region is mapped and are never removed until
+    // the allocator is destroyed, so Owner reads it without locking and
+    // regions that are mapped and unmapped again reuse the same entries.
+    // page_map_mtx serializes the changes.
+    std::atomic<PageMapNode *> page_map_[kPageMapLevelSize];
+    size_t page_map_size_;
+    std::mutex page_map_mtx_;
+
+    std::vector<std::unique_ptr<Allocator>> arenas_;
+
+    static size_t ThreadNumber() noexcept;
+    static void RegionHook(void *context, Allocator *allocator, void *start, size_t size, bool mapped) noexcept;
+    static size_t PageIndex(const void *address) noexcept;
+    static void BindToNode(void *start, size_t size, size_t node) noexcept;
+
+    size_t ArenaIndex(const Allocator *allocator) const noexcept;
+    PageMapLeaf *MapLeaf(size_t page) noexcept;
+    Allocator& LocalArena() noexcept;
+};
@@ -6,16 +6,44 @@
 using MachineWord = uintptr_t;
 
 // MemoryBlock contains header with additional info and the actual data.
+// Blocks of a memory region follow each other, so neighbours are found from
+// the sizes. Every region ends with a fence block.
 struct MemoryBlock {
     // Header fields.
-    size_t Size;
-    bool Used;
-    MemoryBlock *Next;
+    // PrevSize is a boundary tag with the data size of the previous block, so
+    // a free block can be merged with both of its neighbours. It's 0 for the
+    // first block of a region.
+    size_t PrevSize;
+
+    // Data size is a multiple of the machine word so flags are packed into
+    // the low bits of the size word. Trimmed marks a free block whose pages
+    // were already dropped, so Trim doesn't count them twice.
+    size_t Used : 1;
+    size_t Fence : 1;
+    size_t Trimmed : 1;
+    size_t Size : 61;
 
-    // Actual data.
+    // Actual data. Data of a fence points to the first block of the next
+    // region.
     MachineWord Data[1];
 };
 
+// FreeLinks is stored in the Data of a free block and chains it into a free
+// list. Blocks that use it should have at least two machine words of Data.
+struct FreeLinks {
+    MemoryBlock *Next;
+    MemoryBlock *Prev;
+};
+
 size_t SizeOfData();
 
+size_t HeaderSize();
+size_t FenceSize();
+
 MemoryBlock* GetHeader(const MachineWord *data);
+
+FreeLinks* GetFreeLinks(MemoryBlock *memory_block);
+
+MemoryBlock* NextBlock(const MemoryBlock *memory_block);
+MemoryBlock* PrevBlock(const MemoryBlock *memory_block);
+MemoryBlock* NextHeapBlock(const MemoryBlock *memory_block);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+
+#include "allocator.h"
+
+// CachingAllocator puts per-thread caches of small blocks in front of the
+// Allocator. New and Free use the cache of the calling thread without locking,
+// caches are refilled from and flushed to the Allocator in batches under its
+// mutex.
+// Calls served by the caches are recorded to the trace of the Allocator, so
+// a trace shows the calls of the program rather than the refills and flushes.
+class CachingAllocator {
+public:
+    // Biggest data size of a block that is kept in the thread caches.
+    static constexpr size_t kMaxCachedSize = 256;
+
+    // Number of blocks that are taken from the Allocator on a cache miss.
+    static constexpr size_t kRefillCount = 16;
+
+    // Number of allocators a single thread can have caches for. Threads fall
+    // back to the Allocator for the allocators above that.
+    static constexpr size_t kMaxThreadCaches = 8;
+
+    // cache_size limits the number of blocks kept per size class in every
+    // thread cache. Half of them are returned to the Allocator on overflow.
+    CachingAllocator(Allocator& allocator, size_t cache_size = 64) noexcept;
+    ~CachingAllocator() noexcept;
+
+    MachineWord *New(size_t size) noexcept;
+    void Free(MachineWord *data) noexcept;
+
+    // Disable move and copy semantics.
+    CachingAllocator(const CachingAllocator&) = delete;
+    CachingAllocator(CachingAllocator&&) = delete;
+    CachingAllocator& operator=(const CachingAllocator&) = delete;
+    CachingAllocator& operator=(CachingAllocator&&) = delete;
+private:
+    // Number of size classes in a thread cache: one per machine word multiple.
+    static constexpr size_t kCachedClassCount = kMaxCachedSize / sizeof(MachineWord);
+
+    // ThreadCache keeps free blocks of one thread for one CachingAllocator.
+    // Blocks stay used for the Allocator and are chained by their first data
+    // word.
+    struct ThreadCache {
+        std::atomic<CachingAllocator *> Owner;
+
+        // Links of the owner's list of caches.
+        ThreadCache *NextCache;
+        ThreadCache *PrevCache;
+
+        MachineWord *Blocks[kCachedClassCount];
+        size_t Counts[kCachedClassCount];
+    };
+
+    // ThreadCaches contains all caches of a thread and returns their blocks
+    // to the owners when the thread exits.
+    struct ThreadCaches {
+        ThreadCache Caches[kMaxThreadCaches];
+
+        ~ThreadCaches() noexcept;
+    };
+
+    // caches_mtx protects lists of caches of all CachingAllocators and the
+    // ownership of the thread caches.
+    static std::mutex caches_mtx_;
+    static thread_local ThreadCaches thread_caches_;
+
+    Allocator& allocator_;
+    size_t cache_size_;
+
+    // caches contains the head of the list of thread caches of this allocator.
+    ThreadCache *caches_;
+
+    static size_t ClassIndex(size_t size) noexcept;
+
+    ThreadCache *LocalCache() noexcept;
+
+    void RecordNew(const MachineWord *data, size_t size) noexcept;
+    void RecordFree(const MachineWord *data) noexcept;
+
+    bool Refill(ThreadCache *cache, size_t size) noexcept;
+    void Flush(ThreadCache *cache, size_t index, size_t count) noexcept;
+    void FlushAll(ThreadCache *cache) noexcept;
+    void Unregister(ThreadCache *cache) noexcept;
+};
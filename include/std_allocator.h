@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdlib.h>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "allocator.h"
+
+// FreeListStdAllocator lets standard containers allocate from an Allocator.
+// Types that need more than the machine word alignment are allocated with
+// AlignedNew. Like std::allocator it throws std::bad_alloc on a memory error.
+template <typename T>
+class FreeListStdAllocator {
+    template <typename U>
+    friend class FreeListStdAllocator;
+public:
+    using value_type = T;
+
+    FreeListStdAllocator(Allocator& allocator) noexcept : allocator_(&allocator) {}
+
+    template <typename U>
+    FreeListStdAllocator(const FreeListStdAllocator<U>& other) noexcept : allocator_(other.allocator_) {}
+
+    // allocate returns space for n objects of type T.
+    T *allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+
+        MachineWord *data;
+        if (alignof(T) > sizeof(MachineWord)) {
+            data = allocator_->AlignedNew(n * sizeof(T), alignof(T));
+        } else {
+            data = allocator_->New(n * sizeof(T));
+        }
+
+        // Memory error.
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return (T *)data;
+    }
+
+    // deallocate frees space returned by allocate.
+    void deallocate(T *data, size_t) noexcept {
+        allocator_->Free((MachineWord *)data);
+    }
+
+    // Adapters are equal if they allocate from the same Allocator, so one can
+    // free what the other allocated.
+    template <typename U>
+    bool operator==(const FreeListStdAllocator<U>& other) const noexcept {
+        return allocator_ == other.allocator_;
+    }
+
+    template <typename U>
+    bool operator!=(const FreeListStdAllocator<U>& other) const noexcept {
+        return allocator_ != other.allocator_;
+    }
+private:
+    Allocator *allocator_;
+};
+
+// FreeListMemoryResource is a std::pmr::memory_resource backed by an
+// Allocator, so pmr containers can allocate from it.
+class FreeListMemoryResource : public std::pmr::memory_resource {
+public:
+    FreeListMemoryResource(Allocator& allocator) noexcept;
+private:
+    Allocator& allocator_;
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *data, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string.h>
+#include <atomic>
+
+#include "../include/allocation_trace.h"
+
+constexpr char AllocationTrace::kMagic[8];
+
+// AllocationTrace constructor creates the trace file and writes its magic.
+AllocationTrace::AllocationTrace(const std::string& path) noexcept :
+file_(fopen(path.c_str(), "wb")),
+start_(std::chrono::steady_clock::now()),
+next_id_(0) {
+    if (file_ != nullptr) {
+        fwrite(kMagic, sizeof(kMagic), 1, file_);
+    }
+}
+
+// AllocationTrace destructor flushes and closes the trace file.
+AllocationTrace::~AllocationTrace() noexcept {
+    if (file_ != nullptr) {
+        fclose(file_);
+    }
+}
+
+// IsOpen reports if the trace file was created.
+bool AllocationTrace::IsOpen() const noexcept {
+    return file_ != nullptr;
+}
+
+// RecordNew records a New call of the machine word alignment.
+void AllocationTrace::RecordNew(const MachineWord *data, size_t size) noexcept {
+    RecordNew(data, size, sizeof(MachineWord));
+}
+
+// RecordNew gives the new block an id and writes a NEW record with the
+// alignment of the data.
+void AllocationTrace::RecordNew(const MachineWord *data, size_t size, size_t alignment) noexcept {
+    auto id = kNoId;
+
+    if (data != nullptr) {
+        if (!free_ids_.empty()) {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+        } else {
+            id = next_id_++;
+        }
+
+        ids_[data] = id;
+    }
+
+    // Alignments are powers of two, so the log2 fits a byte.
+    uint8_t alignment_log2 = 0;
+    if (alignment > sizeof(MachineWord)) {
+        alignment_log2 = __builtin_ctzll(alignment);
+    }
+
+    Write(TraceOperation::NEW, id, size, alignment_log2);
+}
+
+// RecordFree writes a FREE record and releases the id of the block. Blocks
+// allocated before the trace started aren't recorded.
+void AllocationTrace::RecordFree(const MachineWord *data) noexcept {
+    auto it = ids_.find(data);
+    if (it == ids_.end()) {
+        return;
+    }
+
+    auto id = it->second;
+    ids_.erase(it);
+    free_ids_.push_back(id);
+
+    Write(TraceOperation::FREE, id, 0, 0);
+}
+
+// ThreadNumber returns a sequential number of the calling thread.
+uint16_t AllocationTrace::ThreadNumber() noexcept {
+    static std::atomic<uint16_t> next_thread(0);
+    thread_local uint16_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+
+    return thread;
+}
+
+// Write appends a record to the trace file. Writes are buffered by stdio.
+void AllocationTrace::Write(TraceOperation operation, uint32_t id, size_t size, uint8_t alignment_log2) noexcept {
+    if (file_ == nullptr) {
+        return;
+    }
+
+    TraceRecord record;
+    record.Timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+    record.Size = size;
+    record.Id = id;
+    record.Thread = ThreadNumber();
+    record.Operation = operation;
+    record.AlignmentLog2 = alignment_log2;
+
+    fwrite(&record, sizeof(record), 1, file_);
+}
+
+// ReadTrace reads all records of the trace file. It returns false if the file
+// can't be read or isn't a trace.
+bool ReadTrace(const std::string& path, std::vector<TraceRecord>& records) noexcept {
+    auto file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char magic[sizeof(AllocationTrace::kMagic)];
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, AllocationTrace::kMagic, sizeof(magic)) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    records.clear();
+
+    TraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        records.push_back(record);
+    }
+
+    fclose(file);
+
+    return true;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+
+#include "allocator_test.cpp"
+#include "allocator_benchmark.cpp"
+
+void TestAllocationTrace_1(Allocator& allocator) {
+    std::string test_name = "TestAllocationTrace_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    std::string path = "/tmp/allocation_trace_test.bin";
+
+    {
+        AllocationTrace trace(path);
+        allocator.SetTrace(&trace);
+
+        auto block_1 = allocator.New(8);
+        auto block_2 = allocator.New(100);
+        allocator.Free(block_1);
+        auto block_3 = allocator.New(16);
+        allocator.Free(block_2);
+        allocator.Free(block_3);
+
+        allocator.SetTrace(nullptr);
+    }
+
+    std::vector<TraceRecord> records;
+    if (!ReadTrace(path, records) || records.size() != 6) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 6 records in the trace, but got: " << records.size() << std::endl;
+    } else {
+        // Id of the freed block is reused by the next allocation.
+        TraceOperation operations[6] = {
+            TraceOperation::NEW, TraceOperation::NEW, TraceOperation::FREE,
+            TraceOperation::NEW, TraceOperation::FREE, TraceOperation::FREE
+        };
+        uint32_t ids[6] = {0, 1, 0, 0, 1, 0};
+        uint64_t sizes[6] = {8, 100, 0, 16, 0, 0};
+
+        for (auto i = 0; i < 6; ++i) {
+            if (records[i].Operation != operations[i] || records[i].Id != ids[i] || records[i].Size != sizes[i]) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Unexpected record " << i << ": id " << records[i].Id
+                << ", size " << records[i].Size << std::endl;
+            }
+
+            if (i > 0 && records[i].Timestamp < records[i - 1].Timestamp) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected increasing timestamps, but record " << i
+                << " is older than the previous one" << std::endl;
+            }
+        }
+    }
+
+    // Replay the trace against a new allocator.
+    Allocator::Options options;
+    options.Backend = Allocator::BackendType::MMAP;
+    auto replay_allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT, options);
+    auto result = ReplayTrace(replay_allocator, replay_allocator.Algorithm(), records);
+
+    if (result.PeakLiveSize != 116 || result.Failures != 0 || result.PeakHeapSize < result.PeakLiveSize) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected peak live size 116 without failures, but got: "
+        << result.PeakLiveSize << " and " << result.Failures << " failures, peak heap "
+        << result.PeakHeapSize << std::endl;
+    }
+
+    remove(path.c_str());
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+// AlignmentTarget replays a trace against the allocator and counts the
+// aligned allocations whose data isn't aligned.
+struct AlignmentTarget {
+    Allocator& Target;
+    size_t AlignedCalls;
+    size_t Misaligned;
+
+    MachineWord *New(size_t size) noexcept {
+        return Target.New(size);
+    }
+
+    MachineWord *AlignedNew(size_t size, size_t alignment) noexcept {
+        auto data = Target.AlignedNew(size, alignment);
+
+        ++AlignedCalls;
+        if ((uintptr_t)data % alignment != 0) {
+            ++Misaligned;
+        }
+
+        return data;
+    }
+
+    void Free(MachineWord *data) noexcept {
+        Target.Free(data);
+    }
+};
+
+// TargetHeapSize returns the heap size of the replayed allocator.
+size_t TargetHeapSize(const AlignmentTarget& target) noexcept {
+    return target.Target.HeapSize();
+}
+
+void TestAllocationTrace_2(Allocator& allocator) {
+    std::string test_name = "TestAllocationTrace_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    std::string path = "/tmp/allocation_trace_test_2.bin";
+
+    {
+        AllocationTrace trace(path);
+        allocator.SetTrace(&trace);
+
+        auto block_1 = allocator.AlignedNew(100, 64);
+        auto block_2 = allocator.New(8);
+        auto block_3 = allocator.AlignedNew(8, 4096);
+        block_2 = allocator.Realloc(block_2, 200, 32);
+        allocator.Free(block_1);
+        allocator.Free(block_2);
+        allocator.Free(block_3);
+
+        allocator.SetTrace(nullptr);
+    }
+
+    // Alignment of New is the machine word, it's recorded as 0.
+    std::vector<TraceRecord> records;
+    uint8_t alignments[8] = {6, 0, 12, 0, 5, 0, 0, 0};
+
+    if (!ReadTrace(path, records) || records.size() != 8) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 8 records in the trace, but got: " << records.size() << std::endl;
+    } else {
+        for (auto i = 0; i < 8; ++i) {
+            if (records[i].AlignmentLog2 != alignments[i]) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected alignment log2 " << (int)alignments[i] << " in record " << i
+                << ", but got: " << (int)records[i].AlignmentLog2 << std::endl;
+            }
+        }
+    }
+
+    // Aligned allocations are replayed with AlignedNew.
+    auto replay_allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT);
+    AlignmentTarget target = {replay_allocator, 0, 0};
+    auto result = ReplayTrace(target, replay_allocator.Algorithm(), records);
+
+    if (target.AlignedCalls != 3 || target.Misaligned != 0 || result.Failures != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 3 aligned allocations, but got: " << target.AlignedCalls << " with "
+        << target.Misaligned << " misaligned and " << result.Failures << " failures" << std::endl;
+    }
+
+    remove(path.c_str());
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
@@ -4,39 +4,229 @@
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 
+#include <string.h>
+#include <algorithm>
+#include <thread>
 #include <unistd.h>
+#include <sys/mman.h>
 
+#include "allocation_trace.cpp"
 #include "block.cpp"
 #include "../include/allocator.h"
 
+// lock spins until the flag is taken. It waits for the flag to be cleared
+// with plain loads, so the spinning threads don't take the cache line from
+// the holder.
+void SpinLock::lock() noexcept {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+        while (locked_.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// unlock clears the flag.
+void SpinLock::unlock() noexcept {
+    locked_.store(false, std::memory_order_release);
+}
+
+// try_lock takes the flag if it's clear.
+bool SpinLock::try_lock() noexcept {
+    return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+}
+
+// lock does nothing.
+void NoLock::lock() noexcept {}
+
+// unlock does nothing.
+void NoLock::unlock() noexcept {}
+
+// try_lock always succeeds.
+bool NoLock::try_lock() noexcept {
+    return true;
+}
+
 // Allocator constructor.
-Allocator::Allocator(AllocationAlgorithm algorithm) noexcept :
-algorithm_(algorithm),
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator(AllocationAlgorithm algorithm) noexcept :
+BasicAllocator(algorithm, Options()) {}
+
+// Allocator constructor of the static fit policies.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator() noexcept :
+BasicAllocator(FitPolicy::kAlgorithm, Options()) {}
+
+// Allocator constructor of the static fit policies with the custom options.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator(const Options& options) noexcept :
+BasicAllocator(FitPolicy::kAlgorithm, options) {}
+
+// Allocator constructor with the custom options.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator(AllocationAlgorithm algorithm, const Options& options) noexcept :
+algorithm_(FitPolicy::kDynamic ? algorithm : FitPolicy::kAlgorithm),
+options_(options),
 heap_start_(nullptr),
 heap_end_(heap_start_),
 // last_allocated_block_(heap_start_),
-next_fit_start_block_(heap_start_) {}
+next_fit_start_block_(heap_start_),
+free_bins_(),
+bin_map_(0),
+tlsf_first_map_(0),
+tlsf_second_maps_(),
+arenas_(nullptr),
+growth_size_(ActiveBackend() == BackendType::MMAP ? options.ArenaSize : options.GrowthSize),
+heap_size_(0),
+allocated_size_(0),
+free_size_(0),
+used_blocks_(0),
+free_blocks_(0),
+size_classes_(),
+searches_(0),
+search_steps_(0),
+remote_frees_(nullptr),
+trace_(nullptr),
+slab_arena_(nullptr),
+slab_arena_used_(0),
+page_size_((size_t)sysconf(_SC_PAGESIZE)),
+slab_huge_pages_(false),
+slab_classes_(),
+free_slabs_(nullptr),
+huge_objects_(nullptr),
+huge_objects_count_(0),
+huge_size_(0),
+huge_page_size_(0),
+buffer_(nullptr),
+buffer_size_(0) {
+    // Caller's buffer is the only memory of the BUFFER backend, tiers that
+    // map or drop pages are disabled.
+    if (ActiveBackend() == BackendType::BUFFER) {
+        options_.SlabMaxSize = 0;
+        options_.HugeThreshold = 0;
+        options_.TrimThreshold = 0;
+    }
+
+    if (options_.SlabMaxSize > kSlabClassCount * sizeof(MachineWord)) {
+        options_.SlabMaxSize = kSlabClassCount * sizeof(MachineWord);
+    }
+
+    // Reserve the slab arena up front so the range check in Free doesn't race
+    // with its growth. Its pages are backed by the OS on the first touch.
+    if (options_.SlabMaxSize > 0) {
+        if (options_.HugePageRegions) {
+            options_.SlabArenaSize = (options_.SlabArenaSize + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        }
+
+        auto memory = MapRegion(options_.SlabArenaSize, MAP_NORESERVE, slab_huge_pages_);
+
+        // Slab tier is disabled on memory error.
+        if (memory != nullptr) {
+            slab_arena_ = (char *)memory;
+            NotifyRegion(slab_arena_, options_.SlabArenaSize, true);
+        } else {
+            options_.SlabMaxSize = 0;
+        }
+    }
+}
+
+// Allocator constructor over the caller's buffer.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator(AllocationAlgorithm algorithm, void *buffer, size_t size) noexcept :
+BasicAllocator(algorithm, buffer, size, Options()) {}
+
+// Allocator constructor over the caller's buffer with the custom options. The
+// buffer start is aligned to the machine word and the size is rounded down,
+// a buffer that can't keep a single block leaves the allocator empty.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BasicAllocator(AllocationAlgorithm algorithm, void *buffer, size_t size,
+    const Options& options) noexcept :
+BasicAllocator(algorithm, BufferOptions(options)) {
+    static_assert(BackingPolicy::kDynamic || BackingPolicy::kBackend == BackendType::BUFFER,
+        "Buffer is used only by the BUFFER backend");
+
+    auto start = ((uintptr_t)buffer + sizeof(MachineWord) - 1) & ~(uintptr_t)(sizeof(MachineWord) - 1);
+    auto end = ((uintptr_t)buffer + size) & ~(uintptr_t)(sizeof(MachineWord) - 1);
+
+    if (buffer != nullptr && end > start + HeaderSize() + MinBlockSize() + FenceSize()) {
+        buffer_ = (char *)start;
+        buffer_size_ = end - start;
+    }
+}
 
 // Allocator destructor.
-Allocator::~Allocator() noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::~BasicAllocator() noexcept {
+    if (slab_arena_ != nullptr) {
+        NotifyRegion(slab_arena_, options_.SlabArenaSize, false);
+        munmap(slab_arena_, options_.SlabArenaSize);
+    }
+
+    while (huge_objects_ != nullptr) {
+        auto huge_object = huge_objects_;
+        huge_objects_ = huge_object->Next;
+
+        NotifyRegion(huge_object, huge_object->Size, false);
+        munmap(huge_object, huge_object->Size);
+    }
+
     if (heap_start_ == nullptr) {
         return;
     }
 
-    // Reset the current allocation via brk: https://linux.die.net/man/2/brk
-    // https://stackoverflow.com/questions/6988487/what-does-the-brk-system-call-do
-    brk(heap_start_);
+    switch (ActiveBackend()) {
+        case BackendType::SBRK:
+            // Reset the current allocation via brk: https://linux.die.net/man/2/brk
+            // https://stackoverflow.com/questions/6988487/what-does-the-brk-system-call-do
+            brk(heap_start_);
+            break;
+        case BackendType::MMAP:
+            UnmapArenas();
+            break;
+        case BackendType::BUFFER:
+            // Buffer belongs to the caller.
+            break;
+    }
+}
+
+// ActiveAlgorithm returns the fit of the allocator. It's a constant with the
+// static fit policies, so the switches over it are folded by the compiler.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+AllocationAlgorithm BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ActiveAlgorithm() const noexcept {
+    return FitPolicy::kDynamic ? algorithm_ : FitPolicy::kAlgorithm;
+}
+
+// ActiveBackend returns the backend of the allocator. It's a constant with the
+// static backing policies.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+BackendType BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ActiveBackend() const noexcept {
+    return BackingPolicy::kDynamic ? options_.Backend : BackingPolicy::kBackend;
+}
+
+// BufferOptions returns the options with the BUFFER backend.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+typename BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Options BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BufferOptions(const Options& options) noexcept {
+    auto buffer_options = options;
+    buffer_options.Backend = BackendType::BUFFER;
+
+    return buffer_options;
 }
 
 // Return algorithm type.
-std::string Allocator::Algorithm() const noexcept {
-    switch (algorithm_) {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+std::string BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Algorithm() const noexcept {
+    switch (ActiveAlgorithm()) {
         case AllocationAlgorithm::FIRST_FIT:
             return "first fit";
         case AllocationAlgorithm::NEXT_FIT:
             return "next fit";
         case AllocationAlgorithm::BEST_FIT:
             return "best fit";
+        case AllocationAlgorithm::SEGREGATED_FIT:
+            return "segregated fit";
+        case AllocationAlgorithm::EXPLICIT_FIT:
+            return "explicit fit";
+        case AllocationAlgorithm::TLSF_FIT:
+            return "tlsf fit";
     }
 }
 
@@ -46,7 +236,8 @@ std::string Allocator::Algorithm() const noexcept {
 //  - Align(3) -> 8
 //  - Align(8) -> 8
 //  - Align(9) -> 16
-size_t Allocator::Align(size_t initial_size) noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Align(size_t initial_size) noexcept {
     // Return 0 for 0.
     if (initial_size == 0) {
         return 0;
@@ -87,109 +278,593 @@ size_t Allocator::Align(size_t initial_size) noexcept {
 }
 
 // New allocates new block of memory from OS of at least needed_size bytes.
-MachineWord *Allocator::New(size_t needed_size) noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::New(size_t needed_size) noexcept {
     // Lock mutex.
-    std::lock_guard<std::mutex> lock(_mtx);
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    auto data = NewLocked(needed_size);
+
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        trace->RecordNew(data, needed_size);
+    }
+
+    return data;
+}
+
+// NewLocked implements New and expects the mutex to be locked by the caller.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewLocked(size_t needed_size) noexcept {
+    // Small objects are served by the slab tier if it's on and has space left.
+    if (slab_arena_ != nullptr && needed_size <= options_.SlabMaxSize) {
+        auto data = SlabNew(needed_size);
+        if (data != nullptr) {
+            return data;
+        }
+    }
+
+    if (IsHugeSize(needed_size)) {
+        return NewHuge(needed_size, sizeof(MachineWord));
+    }
 
-    auto size = Allocator::Align(needed_size);
+    return NewBlock(needed_size);
+}
+
+// NewBlock allocates a block with a header bypassing the slab tier.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewBlock(size_t needed_size) noexcept {
+    auto size = AllocationSize(needed_size);
     MemoryBlock *memory_block;
 
     // Search for the needed size of a block in the free-list.
-    memory_block = Allocator::FindBlock(size);
+    memory_block = FindBlock(size);
     if (memory_block) {
         return memory_block->Data;
     }
 
     // Allocate a new block if we can't find a block in the free-list.
-    memory_block = Allocator::NewFromOS(size);
-    memory_block->Size = size;
-    memory_block->Used = true;
+    memory_block = NewFromOS(size);
 
-    // Update information about heap start if it's a new allocation.
-    if (heap_start_ == nullptr) {
-        heap_start_ = memory_block;
-    }
-
-    // Update information about heap end.
-    if (heap_end_ != nullptr) {
-        heap_end_->Next = memory_block;
+    // Memory error.
+    if (memory_block == nullptr) {
+        return nullptr;
     }
 
-    // Chain blocks.
-    heap_end_ = memory_block;
+    // Block from the OS can be bigger than needed, the rest is left free.
+    ListAllocate(memory_block, size);
 
     // Return new data pointer.
     return memory_block->Data;
 }
 
+// AllocationSize returns the data size of a block that is allocated for the
+// needed size.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::AllocationSize(size_t needed_size) const noexcept {
+    auto size = Align(needed_size);
+
+    // Free blocks should be able to keep their free list links.
+    if (size < MinBlockSize()) {
+        return MinBlockSize();
+    }
+
+    return size;
+}
+
 // AllocSizeWithBlock returns allocation size plus MemoryBlock header and first
 // Data element.
 // We remove size of the Data field since user can allocate one word.
-size_t Allocator::AllocSizeWithBlock(size_t size) noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::AllocSizeWithBlock(size_t size) noexcept {
     return sizeof(MemoryBlock) + size - SizeOfData();
 }
 
-// NewFromOS allocates new block from OS or returns a nullptr if a new block
-// can't be allocated (memory error).
-MemoryBlock *Allocator::NewFromOS(size_t size) noexcept {
+// BinIndex returns an index of the size class for the provided aligned size.
+// Sizes up to 128 bytes have exact classes, bigger sizes are grouped by powers
+// of two.
+// Examples:
+//  - BinIndex(8) -> 0
+//  - BinIndex(128) -> 15
+//  - BinIndex(136) -> 16
+//  - BinIndex(256) -> 17
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BinIndex(size_t size) noexcept {
+    if (size <= kExactBinCount * sizeof(MachineWord)) {
+        return size / sizeof(MachineWord) - 1;
+    }
+
+    // Index of the highest set bit. Exact classes end at 2^7 so the first power
+    // of two class starts right after them.
+    size_t log2 = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(size);
+    size_t bin = kExactBinCount + log2 - 7;
+
+    if (bin >= kBinCount) {
+        return kBinCount - 1;
+    }
+
+    return bin;
+}
+
+// TlsfIndex returns an index of the TLSF free list for the provided aligned
+// size. Sizes below kTlsfSmallSize have exact classes, every bigger power of
+// two range is split into kTlsfSecondLevelCount classes.
+// Examples:
+//  - TlsfIndex(16) -> 2
+//  - TlsfIndex(128) -> 16
+//  - TlsfIndex(136) -> 17
+//  - TlsfIndex(256) -> 32
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::TlsfIndex(size_t size) noexcept {
+    if (size < kTlsfSmallSize) {
+        return size / sizeof(MachineWord);
+    }
+
+    // Index of the highest set bit gives the first level, the next
+    // kTlsfSecondLevelLog2 bits give the second level.
+    size_t log2 = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(size);
+    size_t first_level = log2 - 6;
+    size_t second_level = (size >> (log2 - kTlsfSecondLevelLog2)) - kTlsfSecondLevelCount;
+
+    return first_level * kTlsfSecondLevelCount + second_level;
+}
+
+// UsesFreeLists reports if the selected algorithm keeps free blocks in the
+// explicit free lists.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+bool BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::UsesFreeLists() const noexcept {
+    return ActiveAlgorithm() == AllocationAlgorithm::SEGREGATED_FIT ||
+        ActiveAlgorithm() == AllocationAlgorithm::EXPLICIT_FIT ||
+        ActiveAlgorithm() == AllocationAlgorithm::TLSF_FIT;
+}
+
+// FreeListIndex returns an index of the free list that keeps blocks of the
+// provided size.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FreeListIndex(size_t size) const noexcept {
+    if (ActiveAlgorithm() == AllocationAlgorithm::EXPLICIT_FIT) {
+        return 0;
+    }
+
+    if (ActiveAlgorithm() == AllocationAlgorithm::TLSF_FIT) {
+        return TlsfIndex(size);
+    }
+
+    return BinIndex(size);
+}
+
+// MinBlockSize returns the smallest data size of a block. Algorithms with
+// explicit free lists need two words to keep the links in the free blocks.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::MinBlockSize() const noexcept {
+    if (UsesFreeLists()) {
+        return sizeof(FreeLinks);
+    }
+
+    return sizeof(MachineWord);
+}
+
+// InsertFreeBlock pushes a free block to the head of its free list.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::InsertFreeBlock(MemoryBlock *memory_block) noexcept {
+    if (!UsesFreeLists()) {
+        return;
+    }
+
+    auto bin = FreeListIndex(memory_block->Size);
+    auto links = GetFreeLinks(memory_block);
+
+    links->Prev = nullptr;
+    links->Next = free_bins_[bin];
+
+    if (free_bins_[bin] != nullptr) {
+        GetFreeLinks(free_bins_[bin])->Prev = memory_block;
+    }
+
+    free_bins_[bin] = memory_block;
+
+    // Mark the size class as non-empty.
+    if (ActiveAlgorithm() == AllocationAlgorithm::TLSF_FIT) {
+        tlsf_first_map_ |= (uint64_t)1 << (bin / kTlsfSecondLevelCount);
+        tlsf_second_maps_[bin / kTlsfSecondLevelCount] |= (uint32_t)1 << (bin % kTlsfSecondLevelCount);
+    } else {
+        bin_map_ |= (uint64_t)1 << bin;
+    }
+}
+
+// RemoveFreeBlock unlinks a free block from its free list.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::RemoveFreeBlock(MemoryBlock *memory_block) noexcept {
+    if (!UsesFreeLists()) {
+        return;
+    }
+
+    auto bin = FreeListIndex(memory_block->Size);
+    auto links = GetFreeLinks(memory_block);
+
+    if (links->Prev != nullptr) {
+        GetFreeLinks(links->Prev)->Next = links->Next;
+    } else {
+        free_bins_[bin] = links->Next;
+    }
+
+    if (links->Next != nullptr) {
+        GetFreeLinks(links->Next)->Prev = links->Prev;
+    }
+
+    if (free_bins_[bin] != nullptr) {
+        return;
+    }
+
+    // Mark the size class as empty.
+    if (ActiveAlgorithm() == AllocationAlgorithm::TLSF_FIT) {
+        auto first_level = bin / kTlsfSecondLevelCount;
+
+        tlsf_second_maps_[first_level] &= ~((uint32_t)1 << (bin % kTlsfSecondLevelCount));
+        if (tlsf_second_maps_[first_level] == 0) {
+            tlsf_first_map_ &= ~((uint64_t)1 << first_level);
+        }
+    } else {
+        bin_map_ &= ~((uint64_t)1 << bin);
+    }
+}
+
+// NewFromOS allocates new free block of at least size bytes from OS and
+// chains it to the end of the heap. It returns a nullptr if a new block can't
+// be allocated (memory error).
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewFromOS(size_t size) noexcept {
+    switch (ActiveBackend()) {
+        case BackendType::SBRK:
+            return GrowHeap(size);
+        case BackendType::MMAP:
+            return MapArena(size);
+        case BackendType::BUFFER:
+            return UseBuffer(size);
+    }
+
+    return nullptr;
+}
+
+// GrowHeap moves the heap end with sbrk to fit a block of the provided size.
+// If nobody moved the heap end after the last region, that region is extended:
+// its fence becomes the header of the new block and the new block is merged
+// with the free block at the end of the region.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::GrowHeap(size_t size) noexcept {
     // Get the current heap end via sbrk: https://linux.die.net/man/2/sbrk
     // https://stackoverflow.com/questions/6988487/what-does-the-brk-system-call-do
-    auto memory_block = (MemoryBlock *)sbrk(0);
+    auto heap_top = (char *)sbrk(0);
+
+    // Start a new region.
+    if (heap_end_ == nullptr || (char *)heap_end_ + FenceSize() != heap_top) {
+        auto growth_size = NextGrowthSize(AllocSizeWithBlock(size) + FenceSize());
+
+        // Memory error.
+        if (sbrk(growth_size) == (void *)-1) {
+            return nullptr;
+        }
+
+        heap_size_ += growth_size;
+
+        return NewRegion(heap_top, growth_size);
+    }
+
+    // Free block at the end of the region is a part of the new block. The
+    // growth should still fit the header that replaces the fence.
+    auto last_block = PrevBlock(heap_end_);
+    auto needed_size = AllocSizeWithBlock(size);
+    if (last_block != nullptr && !last_block->Used) {
+        // Free block at the end is big enough, but the fit didn't take it.
+        if (last_block->Size >= size) {
+            RemoveFreeBlock(last_block);
+            return last_block;
+        }
+
+        needed_size = size - last_block->Size;
+
+        if (needed_size < HeaderSize()) {
+            needed_size = HeaderSize();
+        }
+    }
+
+    auto growth_size = NextGrowthSize(needed_size);
+
+    // Memory error.
+    if (sbrk(growth_size) == (void *)-1) {
+        return nullptr;
+    }
+
+    heap_size_ += growth_size;
+
+    // Old fence becomes the header of the new block and the new fence is put
+    // at the new heap end.
+    auto memory_block = heap_end_;
+    memory_block->Used = false;
+    memory_block->Fence = false;
+    memory_block->Trimmed = false;
+    memory_block->Size = growth_size - HeaderSize();
+    ++free_blocks_;
+    free_size_ += memory_block->Size;
+
+    heap_end_ = NextBlock(memory_block);
+    heap_end_->PrevSize = memory_block->Size;
+    heap_end_->Used = true;
+    heap_end_->Fence = true;
+    heap_end_->Size = sizeof(MachineWord);
+    heap_end_->Data[0] = (MachineWord)nullptr;
+
+    if (last_block != nullptr && !last_block->Used) {
+        RemoveFreeBlock(last_block);
+        MergeBlocks(last_block);
+        memory_block = last_block;
+    }
+
+    return memory_block;
+}
+
+// NextGrowthSize returns the number of bytes to request from the OS for the
+// needed size and grows the next request by the growth factor.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NextGrowthSize(size_t needed_size) noexcept {
+    if (needed_size > growth_size_) {
+        return Align(needed_size);
+    }
+
+    auto growth_size = Align(growth_size_);
+
+    if (growth_size_ < options_.MaxGrowthSize) {
+        growth_size_ *= options_.GrowthFactor;
+
+        if (growth_size_ > options_.MaxGrowthSize) {
+            growth_size_ = options_.MaxGrowthSize;
+        }
+    }
+
+    return growth_size;
+}
+
+// MapArena maps a new arena that can fit a block of the provided size and
+// returns its first block. The block takes all arena space.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::MapArena(size_t size) noexcept {
+    auto arena_size = NextGrowthSize(sizeof(Arena) + AllocSizeWithBlock(size) + FenceSize());
+
+    // Round arena size up to the page size, or to the huge page size so the
+    // arena is made of whole huge pages.
+    auto unit = options_.HugePageRegions ? kHugePageSize : page_size_;
+    arena_size = (arena_size + unit - 1) / unit * unit;
+
+    bool huge_pages;
+    auto memory = MapRegion(arena_size, 0, huge_pages);
+
+    // Memory error.
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    // Region is reported before its pages are touched, so the hook can set
+    // their memory policy.
+    NotifyRegion(memory, arena_size, true);
 
+    // Chain arenas.
+    auto arena = (Arena *)memory;
+    arena->Next = arenas_;
+    arena->Size = arena_size;
+    arena->HugePageSize = huge_pages ? arena_size : 0;
+    arenas_ = arena;
+    heap_size_ += arena_size;
+    huge_page_size_ += arena->HugePageSize;
+
+    return NewRegion((char *)memory + sizeof(Arena), arena_size - sizeof(Arena));
+}
+
+// UseBuffer turns the caller's buffer into the single region of the heap on
+// the first call. The heap never grows after that, so later calls report a
+// memory error without calling the OS.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::UseBuffer(size_t size) noexcept {
     // Memory error.
-    if (sbrk(AllocSizeWithBlock(size)) == (void *)-1) {
+    if (buffer_ == nullptr || AllocSizeWithBlock(size) + FenceSize() > buffer_size_) {
         return nullptr;
     }
 
+    auto region = buffer_;
+    buffer_ = nullptr;
+    heap_size_ += buffer_size_;
+
+    return NewRegion(region, buffer_size_);
+}
+
+// NewRegion puts a single free block and a fence into a new memory region and
+// chains the region to the end of the heap. It returns the free block.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewRegion(void *start, size_t region_size) noexcept {
+    auto memory_block = (MemoryBlock *)start;
+    memory_block->PrevSize = 0;
+    memory_block->Used = false;
+    memory_block->Fence = false;
+    memory_block->Trimmed = false;
+    memory_block->Size = region_size - HeaderSize() - FenceSize();
+    ++free_blocks_;
+    free_size_ += memory_block->Size;
+
+    auto fence = NextBlock(memory_block);
+    fence->PrevSize = memory_block->Size;
+    fence->Used = true;
+    fence->Fence = true;
+    fence->Size = sizeof(MachineWord);
+    fence->Data[0] = (MachineWord)nullptr;
+
+    // Update information about heap start if it's a new allocation.
+    if (heap_start_ == nullptr) {
+        heap_start_ = memory_block;
+    }
+
+    // Chain regions.
+    if (heap_end_ != nullptr) {
+        heap_end_->Data[0] = (MachineWord)memory_block;
+    }
+
+    heap_end_ = fence;
+
     return memory_block;
 }
 
+// UnmapArenas returns all arenas to the OS.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::UnmapArenas() noexcept {
+    while (arenas_ != nullptr) {
+        auto arena = arenas_;
+        arenas_ = arena->Next;
+
+        huge_page_size_ -= arena->HugePageSize;
+        NotifyRegion(arena, arena->Size, false);
+        munmap(arena, arena->Size);
+    }
+}
+
+// MapRegion maps anonymous memory with the extra mmap flags. If HugePageRegions
+// is set, the size should be a multiple of the huge page size: the region is
+// aligned to the huge page size and advised for huge pages. huge_pages reports
+// if the advice was taken.
+// https://man7.org/linux/man-pages/man2/mmap.2.html
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::MapRegion(size_t size, int flags, bool& huge_pages) noexcept {
+    huge_pages = false;
+
+    if (!options_.HugePageRegions) {
+        auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+        // Memory error.
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+
+        return memory;
+    }
+
+    // Map a huge page more and unmap the unaligned head and the rest of the
+    // tail.
+    auto memory = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+    // Memory error.
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto start = ((uintptr_t)memory + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1);
+    auto head = start - (uintptr_t)memory;
+
+    if (head > 0) {
+        munmap(memory, head);
+    }
+    munmap((char *)start + size, kHugePageSize - head);
+
+    huge_pages = madvise((void *)start, size, MADV_HUGEPAGE) == 0;
+
+    return (void *)start;
+}
+
+// NotifyRegion reports a mapped or unmapped address range to the region hook.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NotifyRegion(void *start, size_t size, bool mapped) noexcept {
+    if (options_.RegionHook != nullptr) {
+        options_.RegionHook(options_.RegionHookContext, this, start, size, mapped);
+    }
+}
+
 // SplitBlock splits a big block of memory to retrieve smaller block of the
 // needed size.
-void Allocator::SplitBlock(MemoryBlock *memory_block, size_t size) noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::SplitBlock(MemoryBlock *memory_block, size_t size) noexcept {
     // Block that is left after splitting.
+    // Its data starts after the data of the current block and its own header.
     auto left_part = (MemoryBlock *)((char *)memory_block + AllocSizeWithBlock(size));
-    left_part->Size = memory_block->Size - size;
+    left_part->PrevSize = size;
     left_part->Used = false;
-    left_part->Next = memory_block->Next;
+    left_part->Fence = false;
+    // Pages of the left part stay dropped if the free block was trimmed.
+    left_part->Trimmed = !memory_block->Used && memory_block->Trimmed;
+    left_part->Size = memory_block->Size - AllocSizeWithBlock(size);
+
+    // Update the boundary tag of the block after the left part.
+    NextBlock(left_part)->PrevSize = left_part->Size;
 
-    // Update current block and chain left part and block.
+    // Update current block.
     memory_block->Size = size;
-    memory_block->Next = left_part;
+
+    ++free_blocks_;
+    free_size_ += left_part->Size;
+    InsertFreeBlock(left_part);
 }
 
 // MergeBlocks merges the selected block with the next one.
-void Allocator::MergeBlocks(MemoryBlock *memory_block) noexcept {
-    // Merge blocks.
-    memory_block->Size += memory_block->Next->Size;
-    memory_block->Next = memory_block->Next->Next;
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::MergeBlocks(MemoryBlock *memory_block) noexcept {
+    auto next = NextBlock(memory_block);
+
+    // Merge blocks. Header of the next block becomes a part of the data, and
+    // the merged block is trimmed again as a whole.
+    memory_block->Size += AllocSizeWithBlock(next->Size);
+    memory_block->Trimmed = false;
+
+    // Two free blocks become one.
+    --free_blocks_;
+    free_size_ += HeaderSize();
+
+    // Update the boundary tag of the block after the merged one.
+    NextBlock(memory_block)->PrevSize = memory_block->Size;
+
+    // Don't leave pointers to the header that doesn't exist anymore.
+    if (next_fit_start_block_ == next) {
+        next_fit_start_block_ = memory_block;
+    }
 }
 
 // FindBlock searches for the next free block that can be used.
 // It uses different algorithm based on selected algorithm of the allocator.
-MemoryBlock *Allocator::FindBlock(size_t size) noexcept {
-    switch (algorithm_) {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FindBlock(size_t size) noexcept {
+    ++searches_;
+
+    switch (ActiveAlgorithm()) {
         case AllocationAlgorithm::FIRST_FIT:
             return FirstFit(size);
         case AllocationAlgorithm::NEXT_FIT:
             return NextFit(size);
         case AllocationAlgorithm::BEST_FIT:
             return BestFit(size);
+        case AllocationAlgorithm::SEGREGATED_FIT:
+            return SegregatedFit(size);
+        case AllocationAlgorithm::EXPLICIT_FIT:
+            return ExplicitFit(size);
+        case AllocationAlgorithm::TLSF_FIT:
+            return TlsfFit(size);
     }
 }
 
 // ListAllocate implements common block allocation function.
 // It will try to split a free block if it's bigger than provided size.
-void Allocator::ListAllocate(MemoryBlock *memory_block, size_t size) const noexcept {
-    // We can't split block if requested size is smaller than allocated size for
-    // a new block.
-    if (sizeof(MemoryBlock) <= (AllocSizeWithBlock(memory_block->Size) - size)) {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ListAllocate(MemoryBlock *memory_block, size_t size) noexcept {
+    // We can't split block if the part that is left can't hold a header and the
+    // smallest block data.
+    --free_blocks_;
+    free_size_ -= memory_block->Size;
+
+    if (memory_block->Size - size >= AllocSizeWithBlock(MinBlockSize())) {
         SplitBlock(memory_block, size);
     }
 
     // Block is allocated and ready to use.
     memory_block->Used = true;
-    memory_block->Size = size;
+
+    ++used_blocks_;
+    allocated_size_ += memory_block->Size;
+    ++size_classes_[BinIndex(memory_block->Size)];
 }
 
 /*
@@ -219,10 +894,13 @@ listAllocate(prev, curr, n):
         next(prev) <- next(curr)
     return result
 */
-MemoryBlock *Allocator::FirstFit(size_t size) const noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FirstFit(size_t size) noexcept {
     MemoryBlock *memory_block = nullptr;
 
-    for (memory_block = heap_start_; memory_block != nullptr; memory_block = memory_block->Next) {
+    for (memory_block = heap_start_; memory_block != nullptr; memory_block = NextHeapBlock(memory_block)) {
+        ++search_steps_;
+
         // Found a free block with suitable size.
         if (!(memory_block->Used) && memory_block->Size >= size) {
             break;
@@ -260,7 +938,8 @@ nextFitAllocate(n):
         else
             return listAllocate(prev, curr, n)
 */
-MemoryBlock *Allocator::NextFit(size_t size) noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NextFit(size_t size) noexcept {
     // Reset start block to start of the heap if it's empty.
     if (next_fit_start_block_ == nullptr) {
         next_fit_start_block_ = heap_start_;
@@ -273,8 +952,10 @@ MemoryBlock *Allocator::NextFit(size_t size) noexcept {
     auto memory_block = initial_start_block;
 
     while (memory_block != nullptr) {
+        ++search_steps_;
+
         if (memory_block->Used || memory_block->Size < size) {
-            memory_block = memory_block->Next;
+            memory_block = NextHeapBlock(memory_block);
 
             // Return to the begining of the list since we use circular first-fit
             // allocation.
@@ -328,10 +1009,13 @@ bestFitAllocate(n):
             bestPrev <- prev
             bestSize <- size(curr)
 */
-MemoryBlock *Allocator::BestFit(size_t size) const noexcept {
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::BestFit(size_t size) noexcept {
     MemoryBlock *best_block = nullptr;
 
-    for (auto memory_block = heap_start_; memory_block != nullptr; memory_block = memory_block->Next) {
+    for (auto memory_block = heap_start_; memory_block != nullptr; memory_block = NextHeapBlock(memory_block)) {
+        ++search_steps_;
+
         // Block is used or it is too small.
         if (memory_block->Used || memory_block->Size < size) {
             continue;
@@ -341,6 +1025,11 @@ MemoryBlock *Allocator::BestFit(size_t size) const noexcept {
         if (best_block == nullptr || memory_block->Size < best_block->Size) {
             best_block = memory_block;
         }
+
+        // Nothing can fit better than the exact size.
+        if (memory_block->Size == size) {
+            break;
+        }
     }
 
     // Memory error.
@@ -354,18 +1043,1370 @@ MemoryBlock *Allocator::BestFit(size_t size) const noexcept {
     return best_block;
 }
 
-// Free deallocates previously created MemoryBlock.
-void Allocator::Free(MachineWord *data) noexcept {
-    // Lock mutex.
-    std::lock_guard<std::mutex> lock(_mtx);
+/*
+SegregatedFit keeps free blocks in the lists split by size classes. Small
+classes contain blocks of exactly one size and any block from them can be used
+right away. Bigger classes cover a power of two range so the class of the
+requested size is checked block by block, and any block from the next non-empty
+class is big enough.
 
-    auto memory_block = GetHeader(data);
+Pseudo-code:
 
-    // Merge the found block with the next one if next block is exist and it's
-    // not used.
-    if (memory_block->Next && !memory_block->Next->Used) {
-        MergeBlocks(memory_block);
+segregatedFitAllocate(n):
+    bin <- binIndex(n)
+    for curr in bins[bin]
+        if size(curr) >= n
+            return listAllocate(curr, n)
+    bin <- nextNonEmptyBin(bin)
+    if bin = null
+        return null
+    return listAllocate(head(bins[bin]), n)
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::SegregatedFit(size_t size) noexcept {
+    auto bin = BinIndex(size);
+    MemoryBlock *memory_block = nullptr;
+
+    for (auto curr = free_bins_[bin]; curr != nullptr; curr = GetFreeLinks(curr)->Next) {
+        ++search_steps_;
+
+        if (curr->Size >= size) {
+            memory_block = curr;
+            break;
+        }
     }
 
-    memory_block->Used = false;
+    // Use the first block of the next non-empty size class.
+    if (memory_block == nullptr && bin + 1 < kBinCount) {
+        auto bigger_bins = bin_map_ & (~(uint64_t)0 << (bin + 1));
+
+        if (bigger_bins != 0) {
+            memory_block = free_bins_[__builtin_ctzll(bigger_bins)];
+            ++search_steps_;
+        }
+    }
+
+    // Memory error.
+    if (memory_block == nullptr) {
+        return nullptr;
+    }
+
+    // Allocate memory on the found block.
+    RemoveFreeBlock(memory_block);
+    ListAllocate(memory_block, size);
+
+    return memory_block;
+}
+
+/*
+ExplicitFit is a first-fit that walks a doubly-linked list of free blocks only.
+The links are kept in the data of the free blocks, so used blocks are never
+visited and a block is linked or unlinked in constant time. Freed blocks are
+pushed to the head of the list.
+
+Pseudo-code:
+
+explicitFitAllocate(n):
+    curr <- freeHead
+    loop
+        if curr == null
+            return null
+        else if size(curr) < n
+            curr <- nextFree(curr)
+        else
+            unlink(curr)
+            return listAllocate(curr, n)
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ExplicitFit(size_t size) noexcept {
+    MemoryBlock *memory_block = nullptr;
+
+    for (memory_block = free_bins_[0]; memory_block != nullptr; memory_block = GetFreeLinks(memory_block)->Next) {
+        ++search_steps_;
+
+        // Found a free block with suitable size.
+        if (memory_block->Size >= size) {
+            break;
+        }
+    }
+
+    // Memory error.
+    if (memory_block == nullptr) {
+        return nullptr;
+    }
+
+    // Allocate memory on the found block.
+    RemoveFreeBlock(memory_block);
+    ListAllocate(memory_block, size);
+
+    return memory_block;
+}
+
+/*
+TlsfFit is a best fit over the two-level segregated fit index. The first level
+splits free blocks by powers of two and the second level splits every power of
+two range linearly. Both levels have bitmaps of non-empty lists, so the search
+takes a few bit operations and never walks a list.
+
+The requested size is rounded up to the next class, then every block of the
+smallest non-empty class at or above it fits and is at most one class bigger
+than the best one.
+
+Pseudo-code:
+
+tlsfFitAllocate(n):
+    fl, sl <- mapping(roundUpToClass(n))
+    slMap <- secondMaps[fl] & (ones << sl)
+    if slMap == 0
+        flMap <- firstMap & (ones << (fl + 1))
+        if flMap == 0
+            return null
+        fl <- lowestBit(flMap)
+        slMap <- secondMaps[fl]
+    sl <- lowestBit(slMap)
+    return listAllocate(head(lists[fl][sl]), n)
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MemoryBlock *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::TlsfFit(size_t size) noexcept {
+    // Blocks of the class of the size can be smaller than the size, so only
+    // the head of its list is checked before the rounded up search.
+    auto own_bin = TlsfIndex(size);
+    if (size >= kTlsfSmallSize && own_bin < kFreeListCount && free_bins_[own_bin] != nullptr &&
+        free_bins_[own_bin]->Size >= size) {
+        ++search_steps_;
+
+        auto memory_block = free_bins_[own_bin];
+        RemoveFreeBlock(memory_block);
+        ListAllocate(memory_block, size);
+
+        return memory_block;
+    }
+
+    // Round the size up to the next class, so any block from the found class
+    // is big enough.
+    auto search_size = size;
+    if (size >= kTlsfSmallSize) {
+        size_t log2 = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(size);
+        search_size += ((size_t)1 << (log2 - kTlsfSecondLevelLog2)) - 1;
+    }
+
+    auto bin = TlsfIndex(search_size);
+    auto first_level = bin / kTlsfSecondLevelCount;
+    auto second_level = bin % kTlsfSecondLevelCount;
+
+    // Memory error. Size is bigger than any block.
+    if (first_level >= kTlsfFirstLevelCount) {
+        return nullptr;
+    }
+
+    // Index lookup is a single step.
+    ++search_steps_;
+
+    // Search for the non-empty class in the same first level class.
+    auto second_map = tlsf_second_maps_[first_level] & (~(uint32_t)0 << second_level);
+
+    // Search for the non-empty class in the bigger first level classes.
+    if (second_map == 0) {
+        auto first_map = first_level + 1 < kTlsfFirstLevelCount ?
+            tlsf_first_map_ & (~(uint64_t)0 << (first_level + 1)) : 0;
+
+        // Memory error.
+        if (first_map == 0) {
+            return nullptr;
+        }
+
+        first_level = __builtin_ctzll(first_map);
+        second_map = tlsf_second_maps_[first_level];
+    }
+
+    auto memory_block = free_bins_[first_level * kTlsfSecondLevelCount + __builtin_ctz(second_map)];
+
+    // Allocate memory on the found block.
+    RemoveFreeBlock(memory_block);
+    ListAllocate(memory_block, size);
+
+    return memory_block;
+}
+
+// Free deallocates previously created MemoryBlock.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Free(MachineWord *data) noexcept {
+    // Lock mutex. A contended free doesn't wait, it leaves the data to the
+    // holder of the lock.
+    std::unique_lock<LockPolicy> lock(_mtx, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        PushRemoteFrees(data, data);
+        return;
+    }
+
+    DrainRemoteFrees();
+
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        trace->RecordFree(data);
+    }
+
+    FreeLocked(data);
+}
+
+// NewBatch allocates count blocks of the same size.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewBatch(size_t needed_size, size_t count, MachineWord **data) noexcept {
+    // Lock mutex.
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    auto allocated = NewBatchLocked(needed_size, count, data);
+
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        for (size_t i = 0; i < allocated; ++i) {
+            trace->RecordNew(data[i], needed_size);
+        }
+    }
+
+    return allocated;
+}
+
+// FreeBatch frees count blocks.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FreeBatch(MachineWord **data, size_t count) noexcept {
+    // Lock mutex.
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        for (size_t i = 0; i < count; ++i) {
+            trace->RecordFree(data[i]);
+        }
+    }
+
+    FreeBatchLocked(data, count);
+}
+
+/*
+NewBatchLocked searches for a single block that fits all blocks of the batch
+with their headers, or takes it from the OS, and carves the blocks from it
+one after another. Blocks are allocated one by one if there is no such block.
+Small blocks are taken from the slab tier.
+
+   +--------+------+--------+------+-----+--------+------+
+   | header | data | header | data | ... | header | data |
+   +--------+------+--------+------+-----+--------+------+
+   ^ found block of count * (header + size) - header bytes
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewBatchLocked(size_t needed_size, size_t count, MachineWord **data) noexcept {
+    if (count == 0) {
+        return 0;
+    }
+
+    auto size = AllocationSize(needed_size);
+    auto total_size = count * AllocSizeWithBlock(size) - HeaderSize();
+    MemoryBlock *memory_block = nullptr;
+
+    // Batch doesn't fit into a single block.
+    auto too_big = count > SIZE_MAX / AllocSizeWithBlock(size);
+
+    // Small objects are taken from the slab tier one by one.
+    auto slab_objects = slab_arena_ != nullptr && needed_size <= options_.SlabMaxSize;
+
+    if (!slab_objects && !IsHugeSize(needed_size) && !too_big) {
+        memory_block = FindBlock(total_size);
+
+        if (memory_block == nullptr) {
+            memory_block = NewFromOS(total_size);
+
+            if (memory_block != nullptr) {
+                ListAllocate(memory_block, total_size);
+            }
+        }
+    }
+
+    // Allocate blocks one by one.
+    if (memory_block == nullptr) {
+        size_t allocated = 0;
+
+        for (; allocated < count; ++allocated) {
+            data[allocated] = NewLocked(needed_size);
+            if (data[allocated] == nullptr) {
+                break;
+            }
+        }
+
+        return allocated;
+    }
+
+    // Found block is accounted as count blocks.
+    --size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ -= memory_block->Size;
+    used_blocks_ += count - 1;
+
+    // Carve the blocks, the last one gets the rest of the found block.
+    for (size_t i = 0; i < count; ++i) {
+        if (i + 1 < count) {
+            auto next = (MemoryBlock *)((char *)memory_block + AllocSizeWithBlock(size));
+            next->PrevSize = size;
+            next->Used = true;
+            next->Fence = false;
+            next->Trimmed = false;
+            next->Size = memory_block->Size - AllocSizeWithBlock(size);
+
+            memory_block->Size = size;
+        } else {
+            NextBlock(memory_block)->PrevSize = memory_block->Size;
+        }
+
+        ++size_classes_[BinIndex(memory_block->Size)];
+        allocated_size_ += memory_block->Size;
+        data[i] = memory_block->Data;
+
+        memory_block = NextBlock(memory_block);
+    }
+
+    return count;
+}
+
+// FreeBatchLocked frees the blocks in the order of their addresses, so every
+// block is merged with the previous one that is already free.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FreeBatchLocked(MachineWord **data, size_t count) noexcept {
+    std::sort(data, data + count);
+
+    for (size_t i = 0; i < count; ++i) {
+        FreeLocked(data[i]);
+    }
+}
+
+// Realloc resizes the data.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Realloc(MachineWord *data, size_t needed_size) noexcept {
+    return Realloc(data, needed_size, sizeof(MachineWord));
+}
+
+// Realloc changes the size of the data and moves it to data of the alignment
+// if it can't be resized in place.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Realloc(MachineWord *data, size_t needed_size, size_t alignment) noexcept {
+    // Lock mutex.
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    auto new_data = ReallocLocked(data, needed_size, alignment);
+
+    // Resize is recorded as a free of the old data and a new allocation.
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        if (data != nullptr) {
+            trace->RecordFree(data);
+        }
+        if (new_data != nullptr) {
+            trace->RecordNew(new_data, needed_size, alignment);
+        }
+    }
+
+    return new_data;
+}
+
+/*
+ReallocLocked resizes the block in place when it's possible and copies the
+data only as the last resort.
+
+Pseudo-code:
+
+realloc(block, n):
+    if n <= size(block)
+        return shrink(block, n)
+    if free(next(block)) and size(block) + size(next(block)) >= n
+        return shrink(absorb(block, next(block)), n)
+    if next(block) = heapEnd
+        return shrink(absorb(block, growHeap(n - size(block))), n)
+    newBlock <- new(n)
+    copy(newBlock, block)
+    free(block)
+    return newBlock
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ReallocLocked(MachineWord *data, size_t needed_size, size_t alignment) noexcept {
+    if (data == nullptr) {
+        return AlignedNewLocked(needed_size, alignment);
+    }
+
+    if (needed_size == 0) {
+        FreeLocked(data);
+        return nullptr;
+    }
+
+    auto size = AllocationSize(needed_size);
+    size_t old_size;
+
+    if (IsSlabObject(data)) {
+        old_size = GetSlab(data)->ObjectSize;
+
+        // Object has enough space.
+        if (needed_size <= old_size) {
+            return data;
+        }
+    } else if (GetHeader(data)->Fence) {
+        old_size = GetHeader(data)->Size;
+
+        // Huge object stays in its own mapping, the OS resizes it.
+        if (IsHugeSize(needed_size)) {
+            auto new_data = ReallocHuge(GetHeader(data), size);
+            if (new_data != nullptr) {
+                return new_data;
+            }
+        }
+    } else {
+        auto memory_block = GetHeader(data);
+        old_size = memory_block->Size;
+
+        // Shrink in place, the end of the block becomes free.
+        if (size <= memory_block->Size) {
+            ShrinkBlock(memory_block, size);
+            return data;
+        }
+
+        // Grow in place into the next free block.
+        auto next = NextBlock(memory_block);
+        if (!next->Used && memory_block->Size + AllocSizeWithBlock(next->Size) >= size) {
+            RemoveFreeBlock(next);
+            ExtendBlock(memory_block);
+            ShrinkBlock(memory_block, size);
+            return data;
+        }
+
+        // Grow in place by moving the end of the sbrk heap. GrowHeap returns
+        // a free block right after the current one.
+        if (ActiveBackend() == BackendType::SBRK && next == heap_end_ &&
+            (char *)heap_end_ + FenceSize() == (char *)sbrk(0)) {
+            auto growth = size > memory_block->Size + HeaderSize() ?
+                size - memory_block->Size - HeaderSize() : MinBlockSize();
+
+            if (GrowHeap(growth) == next) {
+                ExtendBlock(memory_block);
+                ShrinkBlock(memory_block, size);
+                return data;
+            }
+        }
+    }
+
+    // Move the data to a new block.
+    auto new_data = AlignedNewLocked(needed_size, alignment);
+
+    // Memory error. Old data stays valid.
+    if (new_data == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(new_data, data, old_size < needed_size ? old_size : needed_size);
+    FreeLocked(data);
+
+    return new_data;
+}
+
+// AlignedNew allocates data aligned to the provided alignment.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::AlignedNew(size_t needed_size, size_t alignment) noexcept {
+    // Lock mutex.
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    auto data = AlignedNewLocked(needed_size, alignment);
+
+    auto trace = trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        trace->RecordNew(data, needed_size, alignment);
+    }
+
+    return data;
+}
+
+/*
+AlignedNewLocked allocates a block that is big enough to fit the aligned data
+after a leading free block, then moves the block header right before the
+aligned data. The leading part becomes a free block and the trailing part is
+split off.
+
+   +--------+---------+--------+--------------+----------+
+   | header | leading | header | aligned data | trailing |
+   +--------+---------+--------+--------------+----------+
+   ^ free block        ^ used block
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::AlignedNewLocked(size_t needed_size, size_t alignment) noexcept {
+    // Alignment should be a power of two.
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return nullptr;
+    }
+
+    // Data of every block is aligned to the machine word.
+    if (alignment <= sizeof(MachineWord)) {
+        return NewLocked(needed_size);
+    }
+
+    // Objects of a slab start at the 64 bytes boundary, so objects of a size
+    // that is a multiple of the alignment are aligned.
+    if (alignment <= kSlabHeaderSize) {
+        auto slab_size = needed_size == 0 ? alignment : (needed_size + alignment - 1) & ~(alignment - 1);
+
+        if (slab_arena_ != nullptr && slab_size <= options_.SlabMaxSize) {
+            auto data = SlabNew(slab_size);
+            if (data != nullptr) {
+                return data;
+            }
+        }
+    }
+
+    if (IsHugeSize(needed_size)) {
+        return NewHuge(needed_size, alignment);
+    }
+
+    auto size = AllocationSize(needed_size);
+    auto leading_size = AllocSizeWithBlock(MinBlockSize());
+    auto data = NewBlock(size + alignment + leading_size);
+
+    // Memory error.
+    if (data == nullptr) {
+        return nullptr;
+    }
+
+    auto aligned_data = ((uintptr_t)data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    auto memory_block = GetHeader(data);
+
+    // Padding that can't fit a free block is given to the previous block, so
+    // small alignments don't leave fragments. The first block of a region has
+    // no previous block.
+    if (aligned_data != (uintptr_t)data && aligned_data - (uintptr_t)data < leading_size &&
+        memory_block->PrevSize != 0) {
+        auto padding = aligned_data - (uintptr_t)data;
+        auto block_size = memory_block->Size;
+        auto prev = PrevBlock(memory_block);
+
+        if (prev->Used) {
+            --size_classes_[BinIndex(prev->Size)];
+            prev->Size += padding;
+            ++size_classes_[BinIndex(prev->Size)];
+            allocated_size_ += padding;
+        } else {
+            RemoveFreeBlock(prev);
+            prev->Size += padding;
+            prev->Trimmed = false;
+            free_size_ += padding;
+            InsertFreeBlock(prev);
+        }
+
+        // New header overlaps the old one.
+        auto aligned_block = GetHeader((MachineWord *)aligned_data);
+        aligned_block->PrevSize = prev->Size;
+        aligned_block->Used = true;
+        aligned_block->Fence = false;
+        aligned_block->Trimmed = false;
+        aligned_block->Size = block_size - padding;
+        NextBlock(aligned_block)->PrevSize = aligned_block->Size;
+
+        --size_classes_[BinIndex(block_size)];
+        ++size_classes_[BinIndex(aligned_block->Size)];
+        allocated_size_ -= padding;
+
+        if (next_fit_start_block_ == memory_block) {
+            next_fit_start_block_ = aligned_block;
+        }
+
+        ShrinkBlock(aligned_block, size);
+
+        return aligned_block->Data;
+    }
+
+    // Leading part should fit a free block.
+    while (aligned_data != (uintptr_t)data && aligned_data - (uintptr_t)data < leading_size) {
+        aligned_data += alignment;
+    }
+
+    if (aligned_data != (uintptr_t)data) {
+        auto aligned_block = GetHeader((MachineWord *)aligned_data);
+        auto padding = aligned_data - (uintptr_t)data;
+
+        // Account the leading part as a used block so Free turns it into a
+        // free one. The new header isn't a part of the data anymore.
+        --size_classes_[BinIndex(memory_block->Size)];
+        allocated_size_ -= HeaderSize();
+
+        aligned_block->Used = true;
+        aligned_block->Fence = false;
+        aligned_block->Trimmed = false;
+        aligned_block->Size = memory_block->Size - padding;
+        NextBlock(aligned_block)->PrevSize = aligned_block->Size;
+
+        memory_block->Size = padding - HeaderSize();
+        aligned_block->PrevSize = memory_block->Size;
+
+        ++used_blocks_;
+        ++size_classes_[BinIndex(memory_block->Size)];
+        ++size_classes_[BinIndex(aligned_block->Size)];
+
+        FreeLocked(memory_block->Data);
+        memory_block = aligned_block;
+    }
+
+    ShrinkBlock(memory_block, size);
+
+    return memory_block->Data;
+}
+
+// ShrinkBlock splits off the end of the used block if it can fit a free block
+// and merges it with the next free block.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ShrinkBlock(MemoryBlock *memory_block, size_t size) noexcept {
+    if (memory_block->Size - size < AllocSizeWithBlock(MinBlockSize())) {
+        return;
+    }
+
+    --size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ -= memory_block->Size;
+
+    SplitBlock(memory_block, size);
+
+    ++size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ += memory_block->Size;
+
+    // Trailing part is inserted to the free lists by SplitBlock.
+    auto trailing = NextBlock(memory_block);
+    auto next = NextBlock(trailing);
+
+    if (!next->Used) {
+        RemoveFreeBlock(trailing);
+        RemoveFreeBlock(next);
+        MergeBlocks(trailing);
+        InsertFreeBlock(trailing);
+    }
+}
+
+// ExtendBlock merges the used block with the next free block which is already
+// removed from the free lists.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ExtendBlock(MemoryBlock *memory_block) noexcept {
+    --size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ -= memory_block->Size;
+
+    // Merge is accounted as a merge of two free blocks, so the used block is
+    // counted as a free one for it.
+    ++free_blocks_;
+    free_size_ += memory_block->Size;
+
+    MergeBlocks(memory_block);
+
+    --free_blocks_;
+    free_size_ -= memory_block->Size;
+
+    ++size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ += memory_block->Size;
+}
+
+// PushRemoteFrees pushes a chain of data linked by the first word, from first
+// to last, to the remote free list. It doesn't need the lock.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::PushRemoteFrees(MachineWord *first, MachineWord *last) noexcept {
+    auto head = remote_frees_.load(std::memory_order_relaxed);
+
+    do {
+        last[0] = (MachineWord)head;
+    } while (!remote_frees_.compare_exchange_weak(head, first, std::memory_order_release,
+        std::memory_order_relaxed));
+}
+
+// DrainRemoteFrees frees all data of the remote free list. It expects the
+// mutex to be locked by the caller.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::DrainRemoteFrees() noexcept {
+    // Most calls find the list empty, so it's checked before taking it.
+    if (remote_frees_.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    auto data = remote_frees_.exchange(nullptr, std::memory_order_acquire);
+    auto trace = trace_.load(std::memory_order_relaxed);
+
+    while (data != nullptr) {
+        auto next = (MachineWord *)data[0];
+
+        if (trace != nullptr) {
+            trace->RecordFree(data);
+        }
+
+        FreeLocked(data);
+        data = next;
+    }
+}
+
+// FreeLocked implements Free and expects the mutex to be locked by the caller.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FreeLocked(MachineWord *data) noexcept {
+    if (IsSlabObject(data)) {
+        SlabFree(data);
+        return;
+    }
+
+    auto memory_block = GetHeader(data);
+
+    // Used blocks of the heap never have the fence flag.
+    if (memory_block->Fence) {
+        FreeHuge(memory_block);
+        return;
+    }
+
+    // Block is counted as free before it's merged with its neighbours.
+    --used_blocks_;
+    allocated_size_ -= memory_block->Size;
+    --size_classes_[BinIndex(memory_block->Size)];
+    ++free_blocks_;
+    free_size_ += memory_block->Size;
+
+    // Merge the found block with the next one if it's not used. Fence at the
+    // end of the region is always used.
+    auto next = NextBlock(memory_block);
+    if (!next->Used) {
+        RemoveFreeBlock(next);
+        MergeBlocks(memory_block);
+    }
+
+    // Merge the previous block with the found one in the same way, so frees in
+    // any order don't leave adjacent free blocks.
+    auto prev = PrevBlock(memory_block);
+    if (prev && !prev->Used) {
+        RemoveFreeBlock(prev);
+        MergeBlocks(prev);
+        memory_block = prev;
+    }
+
+    memory_block->Used = false;
+    memory_block->Trimmed = false;
+    InsertFreeBlock(memory_block);
+
+    if (options_.TrimThreshold > 0 && memory_block->Size >= options_.TrimThreshold) {
+        TrimBlock(memory_block);
+    }
+}
+
+// UsableSize returns the number of bytes that can be used in the allocated
+// data.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::UsableSize(const MachineWord *data) const noexcept {
+    if (IsSlabObject(data)) {
+        return GetSlab(data)->ObjectSize;
+    }
+
+    return GetHeader(data)->Size;
+}
+
+// IsSlabObject reports if the data belongs to the slab arena.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+bool BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::IsSlabObject(const MachineWord *data) const noexcept {
+    return slab_arena_ != nullptr && (char *)data >= slab_arena_ &&
+        (char *)data < slab_arena_ + options_.SlabArenaSize;
+}
+
+// GetSlab returns the slab of the object. Every slab takes a single page.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+typename BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Slab *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::GetSlab(const MachineWord *data) const noexcept {
+    return (Slab *)((uintptr_t)data & ~(uintptr_t)(page_size_ - 1));
+}
+
+// NewSlab takes a page from the free slabs or from the slab arena and fills
+// it with free objects of the provided size. The slab is put to the list of
+// its size class. It returns a nullptr if the slab arena is used up.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+typename BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Slab *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewSlab(size_t size) noexcept {
+    auto slab = free_slabs_;
+
+    if (slab != nullptr) {
+        free_slabs_ = slab->Next;
+    } else {
+        // Slab tier is off or its arena is used up.
+        if (slab_arena_ == nullptr || slab_arena_used_ + page_size_ > options_.SlabArenaSize) {
+            return nullptr;
+        }
+
+        slab = (Slab *)(slab_arena_ + slab_arena_used_);
+        slab_arena_used_ += page_size_;
+        heap_size_ += page_size_;
+    }
+
+    slab->ObjectSize = size;
+    slab->UsedCount = 0;
+    slab->FreeObjects = nullptr;
+
+    // Chain objects in reverse order so they are given in the address order.
+    auto object_count = (page_size_ - kSlabHeaderSize) / size;
+    for (auto i = object_count; i > 0; --i) {
+        auto object = (MachineWord *)((char *)slab + kSlabHeaderSize + (i - 1) * size);
+        object[0] = (MachineWord)slab->FreeObjects;
+        slab->FreeObjects = object;
+    }
+
+    // Chain the slab to its size class.
+    auto index = size / sizeof(MachineWord) - 1;
+    slab->Prev = nullptr;
+    slab->Next = slab_classes_[index];
+    if (slab->Next != nullptr) {
+        slab->Next->Prev = slab;
+    }
+    slab_classes_[index] = slab;
+
+    return slab;
+}
+
+// SlabNew returns a free object from a slab of the needed size class or a
+// nullptr if there are no slabs left.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::SlabNew(size_t needed_size) noexcept {
+    auto size = Align(needed_size);
+    if (size == 0) {
+        size = sizeof(MachineWord);
+    }
+
+    auto slab = slab_classes_[size / sizeof(MachineWord) - 1];
+    if (slab == nullptr) {
+        slab = NewSlab(size);
+    }
+
+    // Slab arena is used up.
+    if (slab == nullptr) {
+        return nullptr;
+    }
+
+    auto object = slab->FreeObjects;
+    slab->FreeObjects = (MachineWord *)object[0];
+    ++slab->UsedCount;
+
+    ++used_blocks_;
+    allocated_size_ += size;
+    ++size_classes_[BinIndex(size)];
+
+    // Full slabs are removed from the size class until an object is freed.
+    if (slab->FreeObjects == nullptr) {
+        RemoveSlab(slab);
+    }
+
+    return object;
+}
+
+// SlabFree returns the object to its slab. Slabs without used objects can be
+// reused for any size class.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::SlabFree(MachineWord *data) noexcept {
+    auto slab = GetSlab(data);
+    auto index = slab->ObjectSize / sizeof(MachineWord) - 1;
+
+    // Full slab gets a free object so it's returned to its size class.
+    if (slab->FreeObjects == nullptr) {
+        slab->Prev = nullptr;
+        slab->Next = slab_classes_[index];
+        if (slab->Next != nullptr) {
+            slab->Next->Prev = slab;
+        }
+        slab_classes_[index] = slab;
+    }
+
+    data[0] = (MachineWord)slab->FreeObjects;
+    slab->FreeObjects = data;
+    --slab->UsedCount;
+
+    --used_blocks_;
+    allocated_size_ -= slab->ObjectSize;
+    --size_classes_[BinIndex(slab->ObjectSize)];
+
+    if (slab->UsedCount == 0) {
+        RemoveSlab(slab);
+        slab->Next = free_slabs_;
+        free_slabs_ = slab;
+    }
+}
+
+// RemoveSlab unlinks the slab from the list of its size class.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::RemoveSlab(Slab *slab) noexcept {
+    auto index = slab->ObjectSize / sizeof(MachineWord) - 1;
+
+    if (slab->Prev != nullptr) {
+        slab->Prev->Next = slab->Next;
+    } else {
+        slab_classes_[index] = slab->Next;
+    }
+
+    if (slab->Next != nullptr) {
+        slab->Next->Prev = slab->Prev;
+    }
+}
+
+// IsHugeSize reports if the object of the needed size gets its own mapping.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+bool BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::IsHugeSize(size_t needed_size) const noexcept {
+    return options_.HugeThreshold > 0 && needed_size >= options_.HugeThreshold;
+}
+
+// MapHuge maps anonymous memory for a huge object and returns the size of its
+// pages. Huge pages are used if they are asked for: reserved ones first, then
+// transparent ones.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::MapHuge(size_t size, size_t& page_size) noexcept {
+    if (options_.HugeObjectPages) {
+        auto huge_size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        auto memory = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (memory != MAP_FAILED) {
+            page_size = kHugePageSize;
+            return memory;
+        }
+    }
+
+    page_size = page_size_;
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    // Memory error.
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (options_.HugeObjectPages) {
+        madvise(memory, size, MADV_HUGEPAGE);
+    }
+
+    return memory;
+}
+
+/*
+NewHuge maps a region for a single object. The block header is placed right
+before the first aligned data address after the HugeObject header:
+
+    | HugeObject | padding | header | data ... |
+
+The header has both Used and Fence flags and PrevSize keeps the offset of the
+header from the start of the region, so Free finds the region in constant
+time.
+*/
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::NewHuge(size_t needed_size, size_t alignment) noexcept {
+    auto size = AllocationSize(needed_size);
+    auto padding = alignment > sizeof(MachineWord) ? alignment : 0;
+    auto region_size = sizeof(HugeObject) + HeaderSize() + padding + size;
+
+    // Round region size up to the page size.
+    region_size = (region_size + page_size_ - 1) / page_size_ * page_size_;
+
+    size_t page_size;
+    auto memory = MapHuge(region_size, page_size);
+
+    // Memory error.
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    region_size = (region_size + page_size - 1) / page_size * page_size;
+    NotifyRegion(memory, region_size, true);
+
+    auto data = (uintptr_t)memory + sizeof(HugeObject) + HeaderSize();
+    data = (data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+    auto huge_object = (HugeObject *)memory;
+    huge_object->Size = region_size;
+    huge_object->PageSize = page_size;
+    LinkHuge(huge_object);
+
+    auto memory_block = GetHeader((MachineWord *)data);
+    memory_block->PrevSize = (char *)memory_block - (char *)memory;
+    memory_block->Used = true;
+    memory_block->Fence = true;
+    memory_block->Size = size;
+
+    ++used_blocks_;
+    allocated_size_ += size;
+    ++size_classes_[BinIndex(size)];
+    heap_size_ += region_size;
+
+    return memory_block->Data;
+}
+
+// ReallocHuge resizes the mapping of a huge object with mremap, which can move
+// it without copying the data. It returns a nullptr if the mapping can't be
+// resized, the object stays valid then.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+MachineWord *BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ReallocHuge(MemoryBlock *memory_block, size_t size) noexcept {
+    auto offset = memory_block->PrevSize;
+    auto huge_object = (HugeObject *)((char *)memory_block - offset);
+    auto page_size = huge_object->PageSize;
+    auto region_size = offset + HeaderSize() + size;
+
+    // Round region size up to its page size.
+    region_size = (region_size + page_size - 1) / page_size * page_size;
+
+    auto old_region_size = huge_object->Size;
+
+    if (region_size != old_region_size) {
+        UnlinkHuge(huge_object);
+
+        // Old range is unregistered before mremap releases it, so the hook
+        // can't drop the pages another allocator maps there in between.
+        NotifyRegion(huge_object, old_region_size, false);
+
+        auto memory = mremap(huge_object, old_region_size, region_size, MREMAP_MAYMOVE);
+
+        // Memory error.
+        if (memory == MAP_FAILED) {
+            NotifyRegion(huge_object, old_region_size, true);
+            LinkHuge(huge_object);
+            return nullptr;
+        }
+
+        NotifyRegion(memory, region_size, true);
+
+        huge_object = (HugeObject *)memory;
+        huge_object->Size = region_size;
+        LinkHuge(huge_object);
+
+        heap_size_ += region_size - old_region_size;
+        memory_block = (MemoryBlock *)((char *)memory + offset);
+    }
+
+    --size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ -= memory_block->Size;
+
+    memory_block->Size = size;
+
+    ++size_classes_[BinIndex(memory_block->Size)];
+    allocated_size_ += memory_block->Size;
+
+    return memory_block->Data;
+}
+
+// FreeHuge unmaps the region of a huge object.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::FreeHuge(MemoryBlock *memory_block) noexcept {
+    auto huge_object = (HugeObject *)((char *)memory_block - memory_block->PrevSize);
+    auto region_size = huge_object->Size;
+
+    --used_blocks_;
+    allocated_size_ -= memory_block->Size;
+    --size_classes_[BinIndex(memory_block->Size)];
+    heap_size_ -= region_size;
+
+    UnlinkHuge(huge_object);
+    NotifyRegion(huge_object, region_size, false);
+    munmap(huge_object, region_size);
+}
+
+// LinkHuge puts the huge object to the list.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::LinkHuge(HugeObject *huge_object) noexcept {
+    huge_object->Prev = nullptr;
+    huge_object->Next = huge_objects_;
+    if (huge_objects_ != nullptr) {
+        huge_objects_->Prev = huge_object;
+    }
+    huge_objects_ = huge_object;
+
+    ++huge_objects_count_;
+    huge_size_ += huge_object->Size;
+
+    if (huge_object->PageSize == kHugePageSize) {
+        huge_page_size_ += huge_object->Size;
+    }
+}
+
+// UnlinkHuge removes the huge object from the list.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::UnlinkHuge(HugeObject *huge_object) noexcept {
+    if (huge_object->Prev != nullptr) {
+        huge_object->Prev->Next = huge_object->Next;
+    } else {
+        huge_objects_ = huge_object->Next;
+    }
+
+    if (huge_object->Next != nullptr) {
+        huge_object->Next->Prev = huge_object->Prev;
+    }
+
+    --huge_objects_count_;
+    huge_size_ -= huge_object->Size;
+
+    if (huge_object->PageSize == kHugePageSize) {
+        huge_page_size_ -= huge_object->Size;
+    }
+}
+
+// HeapSize returns the number of bytes taken from the OS.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::HeapSize() const noexcept {
+    std::lock_guard<LockPolicy> lock(_mtx);
+
+    return heap_size_;
+}
+
+// SetTrace starts recording New and Free calls to the trace.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+void BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::SetTrace(AllocationTrace *trace) noexcept {
+    std::lock_guard<LockPolicy> lock(_mtx);
+
+    trace_.store(trace, std::memory_order_relaxed);
+}
+
+// GetStats returns the state of the heap. Only the largest free block isn't
+// kept as a counter, it's taken from the biggest non-empty size class of the
+// free lists or found by walking the heap for the algorithms without them.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+typename BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Stats BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::GetStats() const noexcept {
+    std::lock_guard<LockPolicy> lock(_mtx);
+
+    Stats stats = {};
+    stats.HeapSize = heap_size_;
+    stats.AllocatedSize = allocated_size_;
+    stats.FreeSize = free_size_;
+    stats.UsedBlocks = used_blocks_;
+    stats.FreeBlocks = free_blocks_;
+    stats.LargestFreeBlock = LargestFreeBlock();
+    stats.Searches = searches_;
+    stats.SearchSteps = search_steps_;
+    stats.HugeObjects = huge_objects_count_;
+    stats.HugeSize = huge_size_;
+    stats.HugePageSize = huge_page_size_ + (slab_huge_pages_ ? slab_arena_used_ : 0);
+
+    for (size_t i = 0; i < kStatsClassCount; ++i) {
+        stats.SizeClasses[i] = size_classes_[i];
+    }
+
+    if (free_size_ > 0) {
+        stats.Fragmentation = 1 - (double)stats.LargestFreeBlock / free_size_;
+    }
+
+    if (searches_ > 0) {
+        stats.AverageSearchLength = (double)search_steps_ / searches_;
+    }
+
+    return stats;
+}
+
+// LargestFreeBlock returns the data size of the biggest free block.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::LargestFreeBlock() const noexcept {
+    MemoryBlock *list = nullptr;
+
+    switch (ActiveAlgorithm()) {
+        case AllocationAlgorithm::FIRST_FIT:
+        case AllocationAlgorithm::NEXT_FIT:
+        case AllocationAlgorithm::BEST_FIT:
+            break;
+        case AllocationAlgorithm::SEGREGATED_FIT:
+            if (bin_map_ != 0) {
+                list = free_bins_[63 - __builtin_clzll(bin_map_)];
+            }
+            break;
+        case AllocationAlgorithm::EXPLICIT_FIT:
+            list = free_bins_[0];
+            break;
+        case AllocationAlgorithm::TLSF_FIT:
+            if (tlsf_first_map_ != 0) {
+                auto first_level = 63 - __builtin_clzll(tlsf_first_map_);
+                auto second_level = 31 - __builtin_clz(tlsf_second_maps_[first_level]);
+                list = free_bins_[first_level * kTlsfSecondLevelCount + second_level];
+            }
+            break;
+    }
+
+    size_t largest = 0;
+
+    if (UsesFreeLists()) {
+        for (auto curr = list; curr != nullptr; curr = GetFreeLinks(curr)->Next) {
+            if (curr->Size > largest) {
+                largest = curr->Size;
+            }
+        }
+
+        return largest;
+    }
+
+    for (auto curr = heap_start_; curr != nullptr; curr = NextHeapBlock(curr)) {
+        if (!curr->Used && curr->Size > largest) {
+            largest = curr->Size;
+        }
+    }
+
+    return largest;
+}
+
+// Trim returns free memory of all free blocks to the OS.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::Trim() noexcept {
+    std::lock_guard<LockPolicy> lock(_mtx);
+    DrainRemoteFrees();
+
+    size_t released = 0;
+
+    for (auto memory_block = heap_start_; memory_block != nullptr;) {
+        // Block can be removed by the trim, so the next one is taken first.
+        auto next = NextHeapBlock(memory_block);
+
+        if (!memory_block->Used) {
+            released += TrimBlock(memory_block);
+        }
+
+        memory_block = next;
+    }
+
+    return released;
+}
+
+// TrimBlock returns memory of the free block to the OS in the cheapest way:
+// the last block of the sbrk heap is cut off, a block that takes the whole
+// arena is unmapped with it, and pages inside other blocks are dropped.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::TrimBlock(MemoryBlock *memory_block) noexcept {
+    auto next = NextBlock(memory_block);
+
+    // Pages of the caller's buffer are left as they are.
+    if (ActiveBackend() == BackendType::BUFFER) {
+        return 0;
+    }
+
+    if (ActiveBackend() == BackendType::SBRK && next == heap_end_ &&
+        (char *)heap_end_ + FenceSize() == (char *)sbrk(0)) {
+        return ShrinkHeap(memory_block);
+    }
+
+    if (ActiveBackend() == BackendType::MMAP && memory_block->PrevSize == 0 && next->Fence) {
+        return ReleaseArena(memory_block);
+    }
+
+    return ReleasePages(memory_block);
+}
+
+// ShrinkHeap moves the sbrk heap end back over the last free block. The first
+// block of a region keeps its smallest size, so the region stays valid.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ShrinkHeap(MemoryBlock *memory_block) noexcept {
+    size_t released;
+    MemoryBlock *fence;
+
+    RemoveFreeBlock(memory_block);
+
+    if (memory_block->PrevSize != 0) {
+        // Header of the free block becomes the new fence.
+        released = AllocSizeWithBlock(memory_block->Size);
+        --free_blocks_;
+        free_size_ -= memory_block->Size;
+        fence = memory_block;
+    } else {
+        released = memory_block->Size - MinBlockSize();
+        free_size_ -= released;
+        memory_block->Size = MinBlockSize();
+        fence = NextBlock(memory_block);
+        fence->PrevSize = memory_block->Size;
+        InsertFreeBlock(memory_block);
+    }
+
+    fence->Used = true;
+    fence->Fence = true;
+    fence->Size = sizeof(MachineWord);
+    fence->Data[0] = (MachineWord)nullptr;
+    heap_end_ = fence;
+
+    // Don't leave pointers to the header that doesn't exist anymore.
+    if (next_fit_start_block_ == memory_block && fence == memory_block) {
+        next_fit_start_block_ = heap_start_;
+    }
+
+    sbrk(-(intptr_t)released);
+    heap_size_ -= released;
+
+    return released;
+}
+
+// ReleaseArena unmaps the arena that contains only the free block and
+// unchains its region.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ReleaseArena(MemoryBlock *memory_block) noexcept {
+    auto fence = NextBlock(memory_block);
+    auto next_region = (MemoryBlock *)fence->Data[0];
+
+    // Find the fence of the previous region. Arenas are chained in the
+    // reverse order, so all of them are checked.
+    MemoryBlock *prev_fence = nullptr;
+    Arena *arena = nullptr;
+    Arena *prev_arena = nullptr;
+
+    for (Arena *curr = arenas_, *prev = nullptr; curr != nullptr; prev = curr, curr = curr->Next) {
+        auto curr_fence = (MemoryBlock *)((char *)curr + curr->Size - FenceSize());
+
+        if ((MemoryBlock *)(curr + 1) == memory_block) {
+            arena = curr;
+            prev_arena = prev;
+        } else if ((MemoryBlock *)curr_fence->Data[0] == memory_block) {
+            prev_fence = curr_fence;
+        }
+    }
+
+    // Unchain the region.
+    if (prev_fence != nullptr) {
+        prev_fence->Data[0] = (MachineWord)next_region;
+    } else {
+        heap_start_ = next_region;
+    }
+
+    if (heap_end_ == fence) {
+        heap_end_ = prev_fence;
+    }
+
+    if (next_fit_start_block_ == memory_block) {
+        next_fit_start_block_ = heap_start_;
+    }
+
+    RemoveFreeBlock(memory_block);
+    --free_blocks_;
+    free_size_ -= memory_block->Size;
+
+    // Unchain the arena.
+    if (prev_arena != nullptr) {
+        prev_arena->Next = arena->Next;
+    } else {
+        arenas_ = arena->Next;
+    }
+
+    auto released = arena->Size;
+    heap_size_ -= released;
+    huge_page_size_ -= arena->HugePageSize;
+    NotifyRegion(arena, released, false);
+    munmap(arena, released);
+
+    return released;
+}
+
+// ReleasePages drops the whole pages of the free block data with madvise. The
+// header and the free list links stay valid and the pages are zeroed on the
+// next touch. Pages of a block that is already trimmed aren't counted again.
+template <typename FitPolicy, typename LockPolicy, typename BackingPolicy>
+size_t BasicAllocator<FitPolicy, LockPolicy, BackingPolicy>::ReleasePages(MemoryBlock *memory_block) noexcept {
+    if (memory_block->Trimmed) {
+        return 0;
+    }
+
+    auto start = (uintptr_t)memory_block->Data + sizeof(FreeLinks);
+    auto end = (uintptr_t)NextBlock(memory_block);
+
+    // Round start up and end down to the page size.
+    start = (start + page_size_ - 1) & ~(uintptr_t)(page_size_ - 1);
+    end = end & ~(uintptr_t)(page_size_ - 1);
+
+    if (end <= start) {
+        return 0;
+    }
+
+    // Drop the pages: https://man7.org/linux/man-pages/man2/madvise.2.html
+    if (madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+
+    memory_block->Trimmed = true;
+
+    return end - start;
 }
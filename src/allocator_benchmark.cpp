@@ -1,76 +1,892 @@
 #pragma once
 
-#include <iostream>
+#include <errno.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "allocator.cpp"
+#include "arena_allocator.cpp"
+#include "caching_allocator.cpp"
+
+// BenchmarkWorkload selects the order in which the live blocks are freed.
+enum class BenchmarkWorkload {
+    // LIFO frees the most recently allocated block.
+    LIFO,
+
+    // FIFO frees the oldest block.
+    FIFO,
+
+    // RANDOM frees a random live block.
+    RANDOM,
+
+    // PRODUCER_CONSUMER allocates blocks in one thread and frees them in
+    // another one. Threads are split into pairs.
+    PRODUCER_CONSUMER
+};
+
+// BenchmarkFormat selects the output format of the benchmark results.
+enum class BenchmarkFormat {
+    TEXT,
+    CSV,
+    JSON
+};
+
+// SizeClass is an entry of a size distribution: blocks of Size bytes are
+// allocated with a probability proportional to Weight.
+struct SizeClass {
+    size_t Size;
+    size_t Weight;
+};
+
+struct BenchmarkOptions {
+    BenchmarkWorkload Workload = BenchmarkWorkload::LIFO;
+
+    // Sizes is the distribution of the allocation sizes, SizesName is its
+    // name in the output.
+    std::vector<SizeClass> Sizes;
+    std::string SizesName;
+
+    // Operations is the number of allocations done by every thread.
+    size_t Operations = 100000;
+
+    // LiveBlocks is the number of blocks a thread keeps allocated. A block is
+    // freed before every allocation above it.
+    size_t LiveBlocks = 1000;
+
+    size_t Threads = 1;
+    uint64_t Seed = 1;
+
+    // TracePath is a trace written by AllocationTrace. If it's set the trace
+    // is replayed instead of the workload.
+    std::string TracePath;
+};
+
+// LatencyHistogram counts latencies in log-linear buckets: every power of two
+// range of nanoseconds is split into 16 buckets, so a percentile is within
+// 1/16 of the real value.
+struct LatencyHistogram {
+    static constexpr size_t kSubBucketLog2 = 4;
+    static constexpr size_t kSubBucketCount = 1 << kSubBucketLog2;
+    static constexpr size_t kBucketCount = (64 - kSubBucketLog2 + 1) * kSubBucketCount;
+
+    uint64_t Counts[kBucketCount] = {};
+    uint64_t Count = 0;
+    uint64_t Total = 0;
+    uint64_t Max = 0;
+};
+
+// BenchmarkResult contains the latencies of a single benchmark run.
+struct BenchmarkResult {
+    std::string Target;
+    BenchmarkOptions Options;
+
+    // Seconds is the wall time of the run.
+    double Seconds;
+
+    // Failures is the number of allocations that returned a nullptr.
+    size_t Failures;
+
+    LatencyHistogram New;
+    LatencyHistogram Free;
+};
+
+// MallocTarget runs the benchmarks against the system malloc.
+struct MallocTarget {
+    MachineWord *New(size_t size) noexcept {
+        return (MachineWord *)malloc(size);
+    }
+
+    MachineWord *AlignedNew(size_t size, size_t alignment) noexcept {
+        void *data;
+        if (posix_memalign(&data, alignment, size) != 0) {
+            return nullptr;
+        }
+
+        return (MachineWord *)data;
+    }
+
+    void Free(MachineWord *data) noexcept {
+        free(data);
+    }
+};
+
+// ReplayResult contains the results of a trace replay.
+struct ReplayResult {
+    std::string Target;
+    size_t Operations;
+
+    // Seconds is the time spent in New and Free calls.
+    double Seconds;
+
+    // Failures is the number of allocations that returned a nullptr.
+    size_t Failures;
+
+    // PeakLiveSize is the biggest sum of the requested sizes of the live
+    // blocks, PeakHeapSize is the biggest number of bytes taken from the OS.
+    size_t PeakLiveSize;
+    size_t PeakHeapSize;
+};
+
+// TargetHeapSize returns the number of bytes the allocator took from the OS.
+size_t TargetHeapSize(const Allocator& allocator) noexcept {
+    return allocator.HeapSize();
+}
+
+// TargetHeapSize returns the number of bytes malloc took from the OS. It's
+// only known for glibc.
+size_t TargetHeapSize(const MallocTarget&) noexcept {
+#ifdef __GLIBC__
+    auto info = mallinfo2();
+    return info.arena + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// SmallSizes returns the uniform distribution of sizes from 8 to 128 bytes.
+std::vector<SizeClass> SmallSizes() {
+    std::vector<SizeClass> sizes;
+
+    for (size_t size = 8; size <= 128; size += 8) {
+        sizes.push_back({size, 1});
+    }
+
+    return sizes;
+}
+
+// MixedSizes returns a distribution where most of the blocks are small with a
+// tail of bigger blocks up to 4 KiB.
+std::vector<SizeClass> MixedSizes() {
+    return {
+        {8, 10}, {16, 25}, {24, 15}, {32, 15}, {48, 10}, {64, 8}, {96, 5},
+        {128, 4}, {256, 3}, {512, 2}, {1024, 1}, {2048, 1}, {4096, 1}
+    };
+}
+
+// LoadSizes reads a size distribution from a file with a "size weight" pair
+// on every line, for example a histogram of sizes taken from a trace. It
+// returns false if the file can't be read or has no entries.
+bool LoadSizes(const std::string& path, std::vector<SizeClass>& sizes) {
+    std::ifstream file(path);
+    SizeClass size_class;
+
+    sizes.clear();
+    while (file >> size_class.Size >> size_class.Weight) {
+        if (size_class.Size > 0 && size_class.Weight > 0) {
+            sizes.push_back(size_class);
+        }
+    }
+
+    return !sizes.empty();
+}
+
+// RecordLatency adds a latency in nanoseconds to the histogram.
+void RecordLatency(LatencyHistogram& histogram, uint64_t latency) noexcept {
+    size_t bucket = latency;
+
+    // Latencies below kSubBucketCount have exact buckets.
+    if (latency >= LatencyHistogram::kSubBucketCount) {
+        size_t log2 = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(latency);
+        auto shift = log2 - LatencyHistogram::kSubBucketLog2;
+
+        bucket = (shift + 1) * LatencyHistogram::kSubBucketCount +
+            (latency >> shift) - LatencyHistogram::kSubBucketCount;
+    }
+
+    ++histogram.Counts[bucket];
+    ++histogram.Count;
+    histogram.Total += latency;
+
+    if (latency > histogram.Max) {
+        histogram.Max = latency;
+    }
+}
+
+// MergeLatencies adds all latencies of the other histogram to the histogram.
+void MergeLatencies(LatencyHistogram& histogram, const LatencyHistogram& other) noexcept {
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+        histogram.Counts[i] += other.Counts[i];
+    }
+
+    histogram.Count += other.Count;
+    histogram.Total += other.Total;
+
+    if (other.Max > histogram.Max) {
+        histogram.Max = other.Max;
+    }
+}
+
+// Percentile returns the smallest latency of the bucket that contains the
+// provided percentile (0 to 100) of the latencies.
+uint64_t Percentile(const LatencyHistogram& histogram, double percentile) noexcept {
+    auto rank = (uint64_t)(histogram.Count * percentile / 100);
+    uint64_t seen = 0;
+
+    for (size_t bucket = 0; bucket < LatencyHistogram::kBucketCount; ++bucket) {
+        seen += histogram.Counts[bucket];
+        if (seen <= rank || histogram.Counts[bucket] == 0) {
+            continue;
+        }
+
+        if (bucket < LatencyHistogram::kSubBucketCount) {
+            return bucket;
+        }
+
+        auto shift = bucket / LatencyHistogram::kSubBucketCount - 1;
+        return (bucket % LatencyHistogram::kSubBucketCount + LatencyHistogram::kSubBucketCount) << shift;
+    }
+
+    return histogram.Max;
+}
+
+// WorkloadName returns the name of the workload used in the output.
+std::string WorkloadName(BenchmarkWorkload workload) {
+    switch (workload) {
+        case BenchmarkWorkload::LIFO:
+            return "lifo";
+        case BenchmarkWorkload::FIFO:
+            return "fifo";
+        case BenchmarkWorkload::RANDOM:
+            return "random";
+        case BenchmarkWorkload::PRODUCER_CONSUMER:
+            return "producer-consumer";
+    }
+
+    return "";
+}
+
+// NanosecondsSince returns the number of nanoseconds since the start.
+uint64_t NanosecondsSince(std::chrono::steady_clock::time_point start) noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// TimedNew allocates a block of the provided size and records the latency.
+template <typename Target>
+MachineWord *TimedNew(Target& target, size_t size, LatencyHistogram& histogram) noexcept {
+    auto start = std::chrono::steady_clock::now();
+    auto data = target.New(size);
+    RecordLatency(histogram, NanosecondsSince(start));
+
+    return data;
+}
+
+// TimedFree frees a block and records the latency.
+template <typename Target>
+void TimedFree(Target& target, MachineWord *data, LatencyHistogram& histogram) noexcept {
+    auto start = std::chrono::steady_clock::now();
+    target.Free(data);
+    RecordLatency(histogram, NanosecondsSince(start));
+}
+
+// RunWindow allocates blocks keeping at most LiveBlocks of them allocated and
+// frees them in the order of the workload.
+template <typename Target>
+void RunWindow(Target& target, const BenchmarkOptions& options, uint64_t seed, BenchmarkResult& result) {
+    std::mt19937_64 random(seed);
+    std::discrete_distribution<size_t> size_distribution;
+    {
+        std::vector<size_t> weights;
+        for (auto& size_class : options.Sizes) {
+            weights.push_back(size_class.Weight);
+        }
+        size_distribution = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+
+    // Live blocks are kept in a ring: FIFO frees from its head, LIFO from its
+    // tail and RANDOM swaps a random block with the head.
+    auto live_blocks = options.LiveBlocks > 0 ? options.LiveBlocks : 1;
+    std::vector<MachineWord *> ring(live_blocks);
+    size_t head = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < options.Operations; ++i) {
+        if (count == live_blocks) {
+            size_t index = head;
+
+            if (options.Workload == BenchmarkWorkload::LIFO) {
+                index = (head + count - 1) % live_blocks;
+            } else if (options.Workload == BenchmarkWorkload::RANDOM) {
+                std::swap(ring[head], ring[(head + random() % count) % live_blocks]);
+            }
+
+            TimedFree(target, ring[index], result.Free);
+            if (index == head) {
+                head = (head + 1) % live_blocks;
+            }
+            --count;
+        }
+
+        auto size = options.Sizes[size_distribution(random)].Size;
+        auto data = TimedNew(target, size, result.New);
+
+        if (data == nullptr) {
+            ++result.Failures;
+            continue;
+        }
+
+        // Touch the block like a real user would.
+        data[0] = i;
+
+        ring[(head + count) % live_blocks] = data;
+        ++count;
+    }
+
+    for (; count > 0; --count) {
+        TimedFree(target, ring[head], result.Free);
+        head = (head + 1) % live_blocks;
+    }
+}
+
+// BlockQueue passes blocks from a producer thread to a consumer thread.
+struct BlockQueue {
+    std::mutex Mtx;
+    std::vector<MachineWord *> Blocks;
+    bool Done = false;
+};
 
-void AllocateCountTimes(Allocator& allocator, size_t size, unsigned int count) {
-    auto operations = count;
-    auto start = std::chrono::system_clock::now();
+// RunProducer allocates blocks and passes them to the consumer.
+template <typename Target>
+void RunProducer(Target& target, const BenchmarkOptions& options, uint64_t seed, BlockQueue& queue, BenchmarkResult& result) {
+    std::mt19937_64 random(seed);
+    std::vector<size_t> weights;
+    for (auto& size_class : options.Sizes) {
+        weights.push_back(size_class.Weight);
+    }
+    std::discrete_distribution<size_t> size_distribution(weights.begin(), weights.end());
+
+    for (size_t i = 0; i < options.Operations; ++i) {
+        auto size = options.Sizes[size_distribution(random)].Size;
+        auto data = TimedNew(target, size, result.New);
+
+        if (data == nullptr) {
+            ++result.Failures;
+            continue;
+        }
+
+        data[0] = i;
+
+        // Don't let the consumer fall behind more than LiveBlocks blocks.
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(queue.Mtx);
+                if (queue.Blocks.size() < options.LiveBlocks || options.LiveBlocks == 0) {
+                    queue.Blocks.push_back(data);
+                    break;
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(queue.Mtx);
+    queue.Done = true;
+}
+
+// RunConsumer frees blocks allocated by the producer.
+template <typename Target>
+void RunConsumer(Target& target, BlockQueue& queue, BenchmarkResult& result) {
+    std::vector<MachineWord *> blocks;
+    bool done = false;
+
+    while (!done) {
+        {
+            std::lock_guard<std::mutex> lock(queue.Mtx);
+            blocks.swap(queue.Blocks);
+            done = queue.Done && blocks.empty();
+        }
+
+        if (blocks.empty()) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (auto data : blocks) {
+            TimedFree(target, data, result.Free);
+        }
+        blocks.clear();
+    }
+}
+
+// RunBenchmark runs the workload against the target in options.Threads
+// threads and returns the merged latencies of all threads.
+template <typename Target>
+BenchmarkResult RunBenchmark(Target& target, const std::string& name, const BenchmarkOptions& options) {
+    auto thread_count = options.Threads > 0 ? options.Threads : 1;
+
+    // Producers and consumers go in pairs.
+    if (options.Workload == BenchmarkWorkload::PRODUCER_CONSUMER) {
+        thread_count += thread_count % 2;
+    }
+
+    std::vector<BenchmarkResult> results(thread_count);
+    std::vector<BlockQueue> queues(thread_count / 2);
+    std::vector<std::thread> threads;
+    std::atomic<bool> started(false);
+
+    for (size_t t = 0; t < thread_count; ++t) {
+        results[t].Failures = 0;
+
+        threads.emplace_back([&, t]() {
+            // Start all threads at once.
+            while (!started.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+
+            auto seed = options.Seed + t;
+
+            if (options.Workload != BenchmarkWorkload::PRODUCER_CONSUMER) {
+                RunWindow(target, options, seed, results[t]);
+            } else if (t % 2 == 0) {
+                RunProducer(target, options, seed, queues[t / 2], results[t]);
+            } else {
+                RunConsumer(target, queues[t / 2], results[t]);
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    started.store(true, std::memory_order_release);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    BenchmarkResult result;
+    result.Target = name;
+    result.Options = options;
+    result.Options.Threads = thread_count;
+    result.Seconds = NanosecondsSince(start) / 1e9;
+    result.Failures = 0;
+
+    for (auto& thread_result : results) {
+        MergeLatencies(result.New, thread_result.New);
+        MergeLatencies(result.Free, thread_result.Free);
+        result.Failures += thread_result.Failures;
+    }
+
+    return result;
+}
+
+// ReplayTrace plays the records back against the target in the recorded
+// order on a single thread. The heap size is sampled at every new peak of the
+// live size, so it's the heap needed for the peak load.
+template <typename Target>
+ReplayResult ReplayTrace(Target& target, const std::string& name, const std::vector<TraceRecord>& records) {
+    ReplayResult result = {name, records.size(), 0, 0, 0, 0};
+
+    std::vector<MachineWord *> blocks;
+    std::vector<size_t> sizes;
+    size_t live_size = 0;
+    uint64_t nanoseconds = 0;
+
+    // Heap of malloc isn't empty at the start.
+    auto start_heap_size = TargetHeapSize(target);
+
+    for (auto& record : records) {
+        // Allocation failed when it was recorded.
+        if (record.Id == AllocationTrace::kNoId) {
+            continue;
+        }
+
+        if (record.Id >= blocks.size()) {
+            blocks.resize(record.Id + 1, nullptr);
+            sizes.resize(record.Id + 1, 0);
+        }
+
+        if (record.Operation == TraceOperation::FREE) {
+            if (blocks[record.Id] == nullptr) {
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            target.Free(blocks[record.Id]);
+            nanoseconds += NanosecondsSince(start);
+
+            live_size -= sizes[record.Id];
+            blocks[record.Id] = nullptr;
+            continue;
+        }
+
+        // Aligned allocations are replayed with their alignment.
+        auto start = std::chrono::steady_clock::now();
+        auto data = record.AlignmentLog2 == 0 ? target.New(record.Size) :
+            target.AlignedNew(record.Size, (size_t)1 << record.AlignmentLog2);
+        nanoseconds += NanosecondsSince(start);
+
+        if (data == nullptr) {
+            ++result.Failures;
+            continue;
+        }
+
+        blocks[record.Id] = data;
+        sizes[record.Id] = record.Size;
+        live_size += record.Size;
+
+        if (live_size > result.PeakLiveSize) {
+            result.PeakLiveSize = live_size;
+
+            auto heap_size = TargetHeapSize(target) - start_heap_size;
+            if (heap_size > result.PeakHeapSize) {
+                result.PeakHeapSize = heap_size;
+            }
+        }
+    }
+
+    // Free blocks that were live at the end of the trace.
+    for (auto data : blocks) {
+        if (data != nullptr) {
+            target.Free(data);
+        }
+    }
+
+    result.Seconds = nanoseconds / 1e9;
+
+    return result;
+}
+
+// Fragmentation returns the part of the peak heap that wasn't used by the
+// live blocks.
+double Fragmentation(const ReplayResult& result) noexcept {
+    if (result.PeakHeapSize == 0 || result.PeakLiveSize > result.PeakHeapSize) {
+        return 0;
+    }
+
+    return 1 - (double)result.PeakLiveSize / result.PeakHeapSize;
+}
+
+// PrintReplayResults prints the results in the provided format.
+void PrintReplayResults(const std::vector<ReplayResult>& results, BenchmarkFormat format, std::ostream& out) {
+    switch (format) {
+        case BenchmarkFormat::TEXT:
+            for (auto& result : results) {
+                out << result.Target << ": " << result.Operations << " operations in "
+                << (uint64_t)(result.Seconds * 1e9) << "ns, peak live " << result.PeakLiveSize
+                << " bytes, peak heap " << result.PeakHeapSize << " bytes, fragmentation "
+                << Fragmentation(result) << std::endl;
+
+                if (result.Failures > 0) {
+                    out << "    " << result.Failures << " allocations failed" << std::endl;
+                }
+            }
+            break;
+        case BenchmarkFormat::CSV:
+            out << "target,operations,seconds,failures,peak_live_bytes,peak_heap_bytes,fragmentation" << std::endl;
+
+            for (auto& result : results) {
+                out << result.Target << "," << result.Operations << "," << result.Seconds << ","
+                << result.Failures << "," << result.PeakLiveSize << "," << result.PeakHeapSize << ","
+                << Fragmentation(result) << std::endl;
+            }
+            break;
+        case BenchmarkFormat::JSON:
+            out << "[" << std::endl;
+
+            for (size_t i = 0; i < results.size(); ++i) {
+                auto& result = results[i];
 
-    // Allocate count times.
-    while (operations > 0) {
-        allocator.New(size);
-        --operations;
+                out << "  {\"target\": \"" << result.Target
+                << "\", \"operations\": " << result.Operations
+                << ", \"seconds\": " << result.Seconds
+                << ", \"failures\": " << result.Failures
+                << ", \"peak_live_bytes\": " << result.PeakLiveSize
+                << ", \"peak_heap_bytes\": " << result.PeakHeapSize
+                << ", \"fragmentation\": " << Fragmentation(result) << "}"
+                << (i + 1 < results.size() ? "," : "") << std::endl;
+            }
+
+            out << "]" << std::endl;
+            break;
     }
+}
+
+// PrintBenchmarkResults prints the results in the provided format.
+void PrintBenchmarkResults(const std::vector<BenchmarkResult>& results, BenchmarkFormat format, std::ostream& out) {
+    switch (format) {
+        case BenchmarkFormat::TEXT:
+            for (auto& result : results) {
+                out << result.Target << ": " << WorkloadName(result.Options.Workload)
+                << " " << result.Options.SizesName << " sizes, " << result.Options.Threads
+                << " threads, " << result.New.Count << " allocations in "
+                << (uint64_t)(result.Seconds * 1e9) << "ns" << std::endl;
+
+                out << "    new p50 " << Percentile(result.New, 50) << "ns p99 "
+                << Percentile(result.New, 99) << "ns p999 " << Percentile(result.New, 99.9)
+                << "ns max " << result.New.Max << "ns" << std::endl;
+
+                out << "    free p50 " << Percentile(result.Free, 50) << "ns p99 "
+                << Percentile(result.Free, 99) << "ns p999 " << Percentile(result.Free, 99.9)
+                << "ns max " << result.Free.Max << "ns" << std::endl;
+
+                if (result.Failures > 0) {
+                    out << "    " << result.Failures << " allocations failed" << std::endl;
+                }
+            }
+            break;
+        case BenchmarkFormat::CSV:
+            out << "target,workload,sizes,threads,operations,seconds,failures,"
+            << "new_p50_ns,new_p99_ns,new_p999_ns,new_max_ns,"
+            << "free_p50_ns,free_p99_ns,free_p999_ns,free_max_ns" << std::endl;
 
-    auto end = std::chrono::system_clock::now();
+            for (auto& result : results) {
+                out << result.Target << "," << WorkloadName(result.Options.Workload) << ","
+                << result.Options.SizesName << "," << result.Options.Threads << ","
+                << result.New.Count << "," << result.Seconds << "," << result.Failures << ","
+                << Percentile(result.New, 50) << "," << Percentile(result.New, 99) << ","
+                << Percentile(result.New, 99.9) << "," << result.New.Max << ","
+                << Percentile(result.Free, 50) << "," << Percentile(result.Free, 99) << ","
+                << Percentile(result.Free, 99.9) << "," << result.Free.Max << std::endl;
+            }
+            break;
+        case BenchmarkFormat::JSON:
+            out << "[" << std::endl;
 
-    std::cout << allocator.Algorithm() << ": "
-    << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
-    << "ns to allocate " << size << " bytes " << count << " times"
-    << std::endl;
+            for (size_t i = 0; i < results.size(); ++i) {
+                auto& result = results[i];
+
+                out << "  {\"target\": \"" << result.Target
+                << "\", \"workload\": \"" << WorkloadName(result.Options.Workload)
+                << "\", \"sizes\": \"" << result.Options.SizesName
+                << "\", \"threads\": " << result.Options.Threads
+                << ", \"operations\": " << result.New.Count
+                << ", \"seconds\": " << result.Seconds
+                << ", \"failures\": " << result.Failures
+                << ", \"new\": {\"p50_ns\": " << Percentile(result.New, 50)
+                << ", \"p99_ns\": " << Percentile(result.New, 99)
+                << ", \"p999_ns\": " << Percentile(result.New, 99.9)
+                << ", \"max_ns\": " << result.New.Max
+                << "}, \"free\": {\"p50_ns\": " << Percentile(result.Free, 50)
+                << ", \"p99_ns\": " << Percentile(result.Free, 99)
+                << ", \"p999_ns\": " << Percentile(result.Free, 99.9)
+                << ", \"max_ns\": " << result.Free.Max << "}}"
+                << (i + 1 < results.size() ? "," : "") << std::endl;
+            }
+
+            out << "]" << std::endl;
+            break;
+    }
 }
 
-void BenchmarkAllocate(Allocator& allocator) {
-    size_t allocation_sizes[10] = {8, 16, 24, 32, 40, 48, 56, 64, 72, 80};
+// RunBenchmarkSuite runs the workload against every allocation algorithm, the
+// slab tier, the static policies, the caching and arena allocators and the
+// system malloc. Every run gets a new allocator. Allocators use the MMAP
+// backend so they don't share the heap with malloc.
+std::vector<BenchmarkResult> RunBenchmarkSuite(const BenchmarkOptions& options) {
+    Allocator::AllocationAlgorithm algorithms[6] = {
+        Allocator::AllocationAlgorithm::FIRST_FIT,
+        Allocator::AllocationAlgorithm::NEXT_FIT,
+        Allocator::AllocationAlgorithm::BEST_FIT,
+        Allocator::AllocationAlgorithm::SEGREGATED_FIT,
+        Allocator::AllocationAlgorithm::EXPLICIT_FIT,
+        Allocator::AllocationAlgorithm::TLSF_FIT,
+    };
 
-    std::cout << "=== RUN BenchmarkAllocate for the "
-    << allocator.Algorithm() << " algorithm" << std::endl;
+    Allocator::Options allocator_options;
+    allocator_options.Backend = Allocator::BackendType::MMAP;
 
-    for (auto i = 0; i < 10; ++i) {
-        AllocateCountTimes(allocator, allocation_sizes[i], 1000);
+    std::vector<BenchmarkResult> results;
+
+    for (auto algorithm : algorithms) {
+        auto allocator = Allocator(algorithm, allocator_options);
+        results.push_back(RunBenchmark(allocator, allocator.Algorithm(), options));
     }
 
-    std::cout << std::endl;
+    auto slab_options = allocator_options;
+    slab_options.SlabMaxSize = 128;
+    {
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT, slab_options);
+        results.push_back(RunBenchmark(allocator, allocator.Algorithm() + " with slabs", options));
+    }
+    {
+        // Fit and backend are fixed at compile time and the lock spins.
+        BasicAllocator<TlsfFitPolicy, SpinLock, MmapBacking> allocator;
+        results.push_back(RunBenchmark(allocator, "static " + allocator.Algorithm() + " with spin lock", options));
+    }
+    {
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT, slab_options);
+        CachingAllocator caching_allocator(allocator);
+        results.push_back(RunBenchmark(caching_allocator, "caching " + allocator.Algorithm() + " with slabs", options));
+    }
+    {
+        // One arena per thread.
+        auto arena_count = options.Threads > 0 ? options.Threads : 1;
+        ArenaAllocator arena_allocator(Allocator::AllocationAlgorithm::TLSF_FIT, arena_count,
+            ArenaAllocator::ArenaAssignment::ROUND_ROBIN, slab_options);
+        results.push_back(RunBenchmark(arena_allocator, "arena " + arena_allocator.Arena(0).Algorithm() + " with slabs", options));
+    }
+    {
+        MallocTarget target;
+        results.push_back(RunBenchmark(target, "malloc", options));
+    }
+
+    return results;
 }
 
-void AllocateFreeCountTimes(Allocator& allocator, size_t size, unsigned int count) {
-    unsigned int operations = 0;
-    auto start = std::chrono::system_clock::now();
+// RunReplaySuite replays the trace against every allocation algorithm, the
+// slab tier and the system malloc. It returns false if the trace can't be
+// read.
+bool RunReplaySuite(const std::string& path, std::vector<ReplayResult>& results) {
+    std::vector<TraceRecord> records;
+    if (!ReadTrace(path, records)) {
+        return false;
+    }
+
+    Allocator::AllocationAlgorithm algorithms[6] = {
+        Allocator::AllocationAlgorithm::FIRST_FIT,
+        Allocator::AllocationAlgorithm::NEXT_FIT,
+        Allocator::AllocationAlgorithm::BEST_FIT,
+        Allocator::AllocationAlgorithm::SEGREGATED_FIT,
+        Allocator::AllocationAlgorithm::EXPLICIT_FIT,
+        Allocator::AllocationAlgorithm::TLSF_FIT,
+    };
 
-    MachineWord *memory_blocks[count];
+    Allocator::Options allocator_options;
+    allocator_options.Backend = Allocator::BackendType::MMAP;
 
-    // Allocate count times.
-    while (operations < count) {
-        memory_blocks[operations] = allocator.New(size);
-        ++operations;
+    for (auto algorithm : algorithms) {
+        auto allocator = Allocator(algorithm, allocator_options);
+        results.push_back(ReplayTrace(allocator, allocator.Algorithm(), records));
     }
 
-    // Free count times.
-    while (operations > 0) {
-        allocator.Free(memory_blocks[operations]);
-        --operations;
+    auto slab_options = allocator_options;
+    slab_options.SlabMaxSize = 128;
+    {
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT, slab_options);
+        results.push_back(ReplayTrace(allocator, allocator.Algorithm() + " with slabs", records));
     }
+    {
+        MallocTarget target;
+        results.push_back(ReplayTrace(target, "malloc", records));
+    }
+
+    return true;
+}
 
-    auto end = std::chrono::system_clock::now();
+// Biggest number of benchmark threads accepted from the command line.
+constexpr size_t kMaxBenchmarkThreads = 1024;
 
-    std::cout << allocator.Algorithm() << ": "
-    << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
-    << "ns to allocate and then free " << size << " bytes " << count << " times"
-    << std::endl;
+// ParseNumber reads a decimal number of at most max_value. It returns false
+// if the value isn't a number or is out of range.
+bool ParseNumber(const std::string& value, size_t max_value, size_t& number) noexcept {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+
+    errno = 0;
+    auto parsed = strtoull(value.c_str(), nullptr, 10);
+    if (errno == ERANGE || parsed > max_value) {
+        return false;
+    }
+
+    number = parsed;
+
+    return true;
 }
 
-void BenchmarkAllocateFree(Allocator& allocator) {
-    size_t allocation_sizes[10] = {8, 16, 24, 32, 40, 48, 56, 64, 72, 80};
+// ParseBenchmarkArgs reads the benchmark options from the command line
+// arguments:
+//  --format=text|csv|json
+//  --workload=lifo|fifo|random|producer-consumer
+//  --sizes=small|mixed|<file with "size weight" lines>
+//  --threads=N --operations=N --live=N --seed=N
+//  --replay=<trace file>
+// It returns false on unknown arguments and invalid numbers.
+bool ParseBenchmarkArgs(int argc, char **argv, BenchmarkOptions& options, BenchmarkFormat& format) {
+    for (auto i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto separator = arg.find('=');
+        auto name = arg.substr(0, separator);
+        auto value = separator == std::string::npos ? "" : arg.substr(separator + 1);
+
+        if (name == "--benchmark") {
+            continue;
+        } else if (name == "--format" && value == "text") {
+            format = BenchmarkFormat::TEXT;
+        } else if (name == "--format" && value == "csv") {
+            format = BenchmarkFormat::CSV;
+        } else if (name == "--format" && value == "json") {
+            format = BenchmarkFormat::JSON;
+        } else if (name == "--workload" && value == "lifo") {
+            options.Workload = BenchmarkWorkload::LIFO;
+        } else if (name == "--workload" && value == "fifo") {
+            options.Workload = BenchmarkWorkload::FIFO;
+        } else if (name == "--workload" && value == "random") {
+            options.Workload = BenchmarkWorkload::RANDOM;
+        } else if (name == "--workload" && value == "producer-consumer") {
+            options.Workload = BenchmarkWorkload::PRODUCER_CONSUMER;
+        } else if (name == "--sizes" && value == "small") {
+            options.Sizes = SmallSizes();
+            options.SizesName = value;
+        } else if (name == "--sizes" && value == "mixed") {
+            options.Sizes = MixedSizes();
+            options.SizesName = value;
+        } else if (name == "--sizes" && LoadSizes(value, options.Sizes)) {
+            options.SizesName = value;
+        } else if (name == "--threads" || name == "--operations" || name == "--live" || name == "--seed") {
+            size_t number;
+            auto max_value = name == "--threads" ? kMaxBenchmarkThreads : SIZE_MAX;
 
-    std::cout << "=== RUN BenchmarkAllocateFree for the "
-    << allocator.Algorithm() << " algorithm" << std::endl;
+            if (!ParseNumber(value, max_value, number)) {
+                std::cerr << "Invalid benchmark argument value: " << arg << std::endl;
+                return false;
+            }
 
-    for (auto i = 0; i < 10; ++i) {
-        AllocateFreeCountTimes(allocator, allocation_sizes[i], 1000);
+            if (name == "--threads") {
+                options.Threads = number;
+            } else if (name == "--operations") {
+                options.Operations = number;
+            } else if (name == "--live") {
+                options.LiveBlocks = number;
+            } else {
+                options.Seed = number;
+            }
+        } else if (name == "--replay" && !value.empty()) {
+            options.TracePath = value;
+        } else {
+            std::cerr << "Unknown benchmark argument: " << arg << std::endl;
+            return false;
+        }
     }
 
-    std::cout << std::endl;
+    return true;
+}
+
+// BenchmarkAllocators runs every workload on a single thread and on four
+// threads with the small sizes and prints the results.
+void BenchmarkAllocators(size_t operations) {
+    BenchmarkWorkload workloads[4] = {
+        BenchmarkWorkload::LIFO,
+        BenchmarkWorkload::FIFO,
+        BenchmarkWorkload::RANDOM,
+        BenchmarkWorkload::PRODUCER_CONSUMER,
+    };
+
+    BenchmarkOptions options;
+    options.Sizes = SmallSizes();
+    options.SizesName = "small";
+    options.Operations = operations;
+
+    for (auto workload : workloads) {
+        for (size_t threads : {1, 4}) {
+            options.Workload = workload;
+            options.Threads = threads;
+
+            std::cout << "=== RUN BenchmarkAllocators for the " << WorkloadName(workload)
+            << " workload on " << threads << " threads" << std::endl;
+
+            PrintBenchmarkResults(RunBenchmarkSuite(options), BenchmarkFormat::TEXT, std::cout);
+
+            std::cout << std::endl;
+        }
+    }
 }
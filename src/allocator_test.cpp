@@ -1,10 +1,15 @@
 #pragma once
 
+#include <sys/mman.h>
+#include <cstddef>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include "allocator.cpp"
 
-void PrintTestRunning(const std::string& test_name, const Allocator& allocator) {
+template <typename AllocatorType>
+void PrintTestRunning(const std::string& test_name, const AllocatorType& allocator) {
     std::cout << "=== RUN " << test_name << " for the "
     << allocator.Algorithm() << " algorithm" << std::endl;
 }
@@ -83,7 +88,29 @@ void AssertBlocksEqual(const MemoryBlock* a, const MemoryBlock* b, bool& fail_fl
     }
 }
 
-void TestAllocator_common_1(Allocator& allocator) {
+// MinDataSize returns the smallest data size of a block of the algorithm. Fits
+// with free lists keep two links in the data of the free blocks.
+size_t MinDataSize(Allocator::AllocationAlgorithm algorithm) {
+    switch (algorithm) {
+        case Allocator::AllocationAlgorithm::FIRST_FIT:
+        case Allocator::AllocationAlgorithm::NEXT_FIT:
+        case Allocator::AllocationAlgorithm::BEST_FIT:
+            return sizeof(MachineWord);
+        case Allocator::AllocationAlgorithm::SEGREGATED_FIT:
+        case Allocator::AllocationAlgorithm::EXPLICIT_FIT:
+        case Allocator::AllocationAlgorithm::TLSF_FIT:
+            return sizeof(FreeLinks);
+    }
+
+    return sizeof(MachineWord);
+}
+
+// DataSize returns the data size of a block for the aligned size.
+size_t DataSize(size_t size, size_t min_size) {
+    return size < min_size ? min_size : size;
+}
+
+void TestAllocator_common_1(Allocator& allocator, size_t min_size) {
     std::string test_name = "TestAllocator_common_1";
     bool fail = false;
     PrintTestRunning(test_name, allocator);
@@ -92,7 +119,7 @@ void TestAllocator_common_1(Allocator& allocator) {
     auto block_header = GetHeader(block);
 
     AssertUsedBlock(block_header, fail, test_name);
-    AssertAllocatedSize(block_header, sizeof(MachineWord), fail, test_name);
+    AssertAllocatedSize(block_header, DataSize(sizeof(MachineWord), min_size), fail, test_name);
 
     if (!fail) {
         PrintTestPass(test_name);
@@ -101,7 +128,7 @@ void TestAllocator_common_1(Allocator& allocator) {
     std::cout << std::endl;
 }
 
-void TestAllocator_common_2(Allocator& allocator) {
+void TestAllocator_common_2(Allocator& allocator, size_t min_size) {
     std::string test_name = "TestAllocator_common_2";
     bool fail = false;
     PrintTestRunning(test_name, allocator);
@@ -110,7 +137,7 @@ void TestAllocator_common_2(Allocator& allocator) {
     auto block_header = GetHeader(block);
 
     AssertUsedBlock(block_header, fail, test_name);
-    AssertAllocatedSize(block_header, 8, fail, test_name);
+    AssertAllocatedSize(block_header, DataSize(8, min_size), fail, test_name);
 
     if (!fail) {
         PrintTestPass(test_name);
@@ -155,7 +182,7 @@ void TestAllocator_common_4(Allocator& allocator) {
     std::cout << std::endl;
 }
 
-void TestAllocator_common_5(Allocator& allocator) {
+void TestAllocator_common_5(Allocator& allocator, size_t min_size) {
     std::string test_name = "TestAllocator_common_5";
     bool fail = false;
     PrintTestRunning(test_name, allocator);
@@ -168,14 +195,14 @@ void TestAllocator_common_5(Allocator& allocator) {
     AssertUsedBlock(block_1_header, fail, test_name);
     AssertUsedBlock(block_2_header, fail, test_name);
     AssertAllocatedSize(block_1_header, 16, fail, test_name);
-    AssertAllocatedSize(block_2_header, 8, fail, test_name);
+    AssertAllocatedSize(block_2_header, DataSize(8, min_size), fail, test_name);
 
     allocator.Free(block_2);
     AssertFreeBlock(block_2_header, fail, test_name);
 
     auto block_3 = allocator.New(8);
     auto block_3_header = GetHeader(block_3);
-    AssertAllocatedSize(block_3_header, 8, fail, test_name);
+    AssertAllocatedSize(block_3_header, DataSize(8, min_size), fail, test_name);
 
     // Check that block 2 is reused.
     AssertUsedBlock(block_2_header, fail, test_name);
@@ -189,28 +216,33 @@ void TestAllocator_common_5(Allocator& allocator) {
     std::cout << std::endl;
 }
 
-void TestAllocator_common_6(Allocator& allocator) {
+void TestAllocator_common_6(Allocator& allocator, size_t min_size) {
     std::string test_name = "TestAllocator_common_6";
     bool fail = false;
     PrintTestRunning(test_name, allocator);
 
+    // Big blocks can hold two 32 bytes blocks after splitting.
+    auto big_size = 32 + sizeof(MemoryBlock) - SizeOfData() + 32;
+
     auto block_1 = allocator.New(6);  // 8
-    auto block_2 = allocator.New(60); // 64
-    auto block_3 = allocator.New(60); // 64
+    auto block_2 = allocator.New(big_size);
+    auto guard = allocator.New(6);    // 8, keeps big blocks from merging
+    auto block_3 = allocator.New(big_size);
     auto block_1_header = GetHeader(block_1);
     auto block_2_header = GetHeader(block_2);
     auto block_3_header = GetHeader(block_3);
 
     AssertUsedBlock(block_1_header, fail, test_name);
     AssertUsedBlock(block_2_header, fail, test_name);
+    AssertUsedBlock(GetHeader(guard), fail, test_name);
     AssertUsedBlock(block_3_header, fail, test_name);
-    AssertAllocatedSize(block_1_header, 8, fail, test_name);
-    AssertAllocatedSize(block_2_header, 64, fail, test_name);
-    AssertAllocatedSize(block_3_header, 64, fail, test_name);
+    AssertAllocatedSize(block_1_header, DataSize(8, min_size), fail, test_name);
+    AssertAllocatedSize(block_2_header, big_size, fail, test_name);
+    AssertAllocatedSize(block_3_header, big_size, fail, test_name);
 
-    // Free big blocks.
-    allocator.Free(block_2);
+    // Free big blocks. Fits with LIFO free lists take block_2 first as well.
     allocator.Free(block_3);
+    allocator.Free(block_2);
     AssertFreeBlock(block_2_header, fail, test_name);
     AssertFreeBlock(block_3_header, fail, test_name);
 
@@ -316,6 +348,94 @@ void TestAllocator_common_7(Allocator& allocator) {
     std::cout << std::endl;
 }
 
+void TestAllocator_common_8(Allocator& allocator) {
+    std::string test_name = "TestAllocator_common_8";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(16);
+    auto block_2 = allocator.New(16);
+    auto block_3 = allocator.New(16);
+    auto block_4 = allocator.New(16);
+    auto block_5 = allocator.New(16);
+
+    auto block_1_header = GetHeader(block_1);
+    auto block_3_header = GetHeader(block_3);
+
+    // Free blocks in ascending order so every block is merged with the
+    // previous one.
+    allocator.Free(block_1);
+    allocator.Free(block_2);
+    allocator.Free(block_3);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertUsedBlock(GetHeader(block_4), fail, test_name);
+
+    auto header_size = sizeof(MemoryBlock) - SizeOfData();
+    AssertAllocatedSize(block_1_header, 3 * 16 + 2 * header_size, fail, test_name);
+
+    // Free blocks around block_4 so it's merged with both neighbours.
+    allocator.Free(block_5);
+    allocator.Free(block_4);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 5 * 16 + 4 * header_size, fail, test_name);
+
+    // Check that the merged block is reused and split again.
+    auto block_6 = allocator.New(16 + header_size + 16);
+    auto block_6_header = GetHeader(block_6);
+    AssertBlocksEqual(block_1_header, block_6_header, fail, test_name);
+    AssertBlocksEqual(block_3_header, NextHeapBlock(block_6_header), fail, test_name);
+    AssertFreeBlock(block_3_header, fail, test_name);
+    AssertBlocksEqual(block_6_header, PrevBlock(block_3_header), fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_common_9(Allocator& allocator) {
+    std::string test_name = "TestAllocator_common_9";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Header keeps the size of the previous block and the size with flags.
+    if (HeaderSize() != 2 * sizeof(MachineWord)) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected " << 2 * sizeof(MachineWord)
+        << " bytes block header, but got: " << HeaderSize() << std::endl;
+    }
+
+    auto block_1 = allocator.New(16);
+    auto block_2 = allocator.New(16);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+
+    // Blocks follow each other and the next block is found from the size.
+    auto distance = (size_t)((char *)block_2 - (char *)block_1);
+    if (distance != 16 + HeaderSize()) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected blocks to be " << 16 + HeaderSize()
+        << " bytes apart, but got: " << distance << std::endl;
+    }
+    AssertBlocksEqual(NextBlock(block_1_header), block_2_header, fail, test_name);
+    AssertBlocksEqual(PrevBlock(block_2_header), block_1_header, fail, test_name);
+
+    // Flags don't change the size.
+    AssertAllocatedSize(block_1_header, 16, fail, test_name);
+    allocator.Free(block_2);
+    AssertFreeBlock(block_2_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 16, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
 void TestAllocator_next_fit_1(Allocator& allocator) {
     std::string test_name = "TestAllocator_next_fit_1";
     bool fail = false;
@@ -390,7 +510,9 @@ void TestAllocator_next_fit_2(Allocator& allocator) {
     allocator.Free(block_4);
     allocator.Free(block_5);
     AssertFreeBlock(block_4_header, fail, test_name);
-    AssertFreeBlock(block_5_header, fail, test_name);
+
+    // Adjacent free blocks are merged, block_5 header is a part of block_4 now.
+    AssertAllocatedSize(block_4_header, 32 + sizeof(MemoryBlock) - SizeOfData() + 32, fail, test_name);
 
     auto block_6 = allocator.New(31);
     auto block_6_header = GetHeader(block_6);
@@ -404,7 +526,8 @@ void TestAllocator_next_fit_2(Allocator& allocator) {
     auto block_7 = allocator.New(27);
     auto block_7_header = GetHeader(block_7);
 
-    // Check that block 5 is reused.
+    // Check that block 5 is reused: the part left after splitting block 4
+    // starts at its place.
     AssertUsedBlock(block_5_header, fail, test_name);
     AssertUsedBlock(block_7_header, fail, test_name);
     AssertBlocksEqual(block_5_header, block_7_header, fail, test_name);
@@ -473,3 +596,1465 @@ void TestAllocator_best_fit_1(Allocator& allocator) {
 
     std::cout << std::endl;
 }
+
+void TestAllocator_segregated_fit_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_segregated_fit_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(3);   // 16, free block should keep two links
+    auto block_2 = allocator.New(20);  // 24
+    auto block_3 = allocator.New(8);   // 16
+    auto block_4 = allocator.New(200); // 200
+    auto block_5 = allocator.New(8);   // 16
+
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+    auto block_3_header = GetHeader(block_3);
+    auto block_4_header = GetHeader(block_4);
+    auto block_5_header = GetHeader(block_5);
+
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertUsedBlock(block_2_header, fail, test_name);
+    AssertUsedBlock(block_3_header, fail, test_name);
+    AssertUsedBlock(block_4_header, fail, test_name);
+    AssertUsedBlock(block_5_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 16, fail, test_name);
+    AssertAllocatedSize(block_2_header, 24, fail, test_name);
+    AssertAllocatedSize(block_3_header, 16, fail, test_name);
+    AssertAllocatedSize(block_4_header, 200, fail, test_name);
+    AssertAllocatedSize(block_5_header, 16, fail, test_name);
+
+    allocator.Free(block_2);
+    allocator.Free(block_4);
+    AssertFreeBlock(block_2_header, fail, test_name);
+    AssertFreeBlock(block_4_header, fail, test_name);
+
+    // Check that block_2 is reused from its exact size class.
+    auto block_6 = allocator.New(17); // 24
+    auto block_6_header = GetHeader(block_6);
+    AssertAllocatedSize(block_6_header, 24, fail, test_name);
+    AssertUsedBlock(block_2_header, fail, test_name);
+    AssertBlocksEqual(block_2_header, block_6_header, fail, test_name);
+
+    // Check that block_4 is taken from the bigger size class and split.
+    auto block_7 = allocator.New(100); // 104
+    auto block_7_header = GetHeader(block_7);
+    AssertAllocatedSize(block_7_header, 104, fail, test_name);
+    AssertUsedBlock(block_4_header, fail, test_name);
+    AssertBlocksEqual(block_4_header, block_7_header, fail, test_name);
+
+    // Check that the part left after splitting is reused from its size class.
+    auto left_size = 200 - 104 - (sizeof(MemoryBlock) - SizeOfData());
+    auto block_8 = allocator.New(left_size);
+    auto block_8_header = GetHeader(block_8);
+    AssertAllocatedSize(block_8_header, left_size, fail, test_name);
+    AssertBlocksEqual(NextHeapBlock(block_4_header), block_8_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_segregated_fit_2(Allocator& allocator) {
+    std::string test_name = "TestAllocator_segregated_fit_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(16);
+    auto block_2 = allocator.New(16);
+    auto block_3 = allocator.New(16);
+
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+    auto block_3_header = GetHeader(block_3);
+
+    // Free blocks so block_1 is merged with block_2.
+    allocator.Free(block_2);
+    allocator.Free(block_1);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertUsedBlock(block_3_header, fail, test_name);
+
+    // Header of block_2 becomes a part of block_1 data.
+    auto merged_size = 16 + sizeof(MemoryBlock) - SizeOfData() + 16;
+    AssertAllocatedSize(block_1_header, merged_size, fail, test_name);
+
+    // Check that merged block is found in the size class of its new size.
+    auto block_4 = allocator.New(merged_size);
+    auto block_4_header = GetHeader(block_4);
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertBlocksEqual(block_1_header, block_4_header, fail, test_name);
+
+    // Check that nothing is left in the size class of the merged blocks.
+    auto block_5 = allocator.New(16);
+    auto block_5_header = GetHeader(block_5);
+    if (block_5_header == block_1_header || block_5_header == block_2_header) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a new block but merged block is reused" << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_explicit_fit_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_explicit_fit_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(32);
+    auto block_2 = allocator.New(8);  // 16
+    auto block_3 = allocator.New(32);
+    auto block_4 = allocator.New(8);  // 16
+
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+    auto block_3_header = GetHeader(block_3);
+    auto block_4_header = GetHeader(block_4);
+
+    AssertAllocatedSize(block_1_header, 32, fail, test_name);
+    AssertAllocatedSize(block_2_header, 16, fail, test_name);
+    AssertAllocatedSize(block_3_header, 32, fail, test_name);
+    AssertAllocatedSize(block_4_header, 16, fail, test_name);
+
+    allocator.Free(block_1);
+    allocator.Free(block_3);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertFreeBlock(block_3_header, fail, test_name);
+
+    // Check that the last freed block is reused first.
+    auto block_5 = allocator.New(32);
+    auto block_5_header = GetHeader(block_5);
+    AssertUsedBlock(block_3_header, fail, test_name);
+    AssertBlocksEqual(block_3_header, block_5_header, fail, test_name);
+
+    // Check that a block which is too small to split keeps its whole size.
+    auto block_6 = allocator.New(16);
+    auto block_6_header = GetHeader(block_6);
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertBlocksEqual(block_1_header, block_6_header, fail, test_name);
+    AssertAllocatedSize(block_6_header, 32, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_tlsf_fit_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_tlsf_fit_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Free blocks are separated by the used ones so they aren't merged.
+    auto block_1 = allocator.New(40);
+    allocator.New(8);
+    auto block_2 = allocator.New(32);
+    allocator.New(8);
+    auto block_3 = allocator.New(1000);
+    allocator.New(8);
+    auto block_4 = allocator.New(600);
+    allocator.New(8);
+
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+    auto block_3_header = GetHeader(block_3);
+    auto block_4_header = GetHeader(block_4);
+
+    allocator.Free(block_4);
+    allocator.Free(block_3);
+    allocator.Free(block_2);
+    allocator.Free(block_1);
+
+    // Check that the best block is used even if a bigger one is found first.
+    auto block_5 = allocator.New(32);
+    auto block_5_header = GetHeader(block_5);
+    AssertBlocksEqual(block_2_header, block_5_header, fail, test_name);
+    AssertAllocatedSize(block_5_header, 32, fail, test_name);
+    AssertFreeBlock(block_1_header, fail, test_name);
+
+    // Check that the block of the smallest class that fits is used and split.
+    auto block_6 = allocator.New(500); // 504
+    auto block_6_header = GetHeader(block_6);
+    AssertBlocksEqual(block_4_header, block_6_header, fail, test_name);
+    AssertAllocatedSize(block_6_header, 504, fail, test_name);
+    AssertFreeBlock(block_3_header, fail, test_name);
+
+    // Check that the part left after splitting is reused from its class.
+    auto left_size = 600 - 504 - (sizeof(MemoryBlock) - SizeOfData());
+    auto block_7 = allocator.New(left_size);
+    AssertBlocksEqual(NextHeapBlock(block_6_header), GetHeader(block_7), fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_tlsf_fit_2(Allocator& allocator) {
+    std::string test_name = "TestAllocator_tlsf_fit_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Freed block at the end of the heap is in the class of the smaller
+    // size, so the rounded up search misses it.
+    auto block_1 = allocator.New(536);
+    auto block_1_header = GetHeader(block_1);
+    auto heap_size = allocator.HeapSize();
+    allocator.Free(block_1);
+
+    // Check that the block is reused from its class without growing the heap.
+    auto block_2 = allocator.New(520);
+    AssertBlocksEqual(block_1_header, GetHeader(block_2), fail, test_name);
+
+    if (allocator.HeapSize() != heap_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the heap of " << heap_size << " bytes, but got: " << allocator.HeapSize() << std::endl;
+    }
+
+    // Free block at the end of the heap that isn't the head of its class
+    // is taken by the heap growth without growing the heap.
+    auto block_3 = allocator.New(512);
+    auto block_3_header = GetHeader(block_3);
+    auto block_4 = allocator.New(8);
+    auto block_5 = allocator.New(536);
+    auto block_5_header = GetHeader(block_5);
+    heap_size = allocator.HeapSize();
+
+    allocator.Free(block_5);
+    allocator.Free(block_3);
+    auto block_6 = allocator.New(520);
+    AssertBlocksEqual(block_5_header, GetHeader(block_6), fail, test_name);
+    AssertFreeBlock(block_3_header, fail, test_name);
+
+    if (allocator.HeapSize() != heap_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the heap of " << heap_size << " bytes, but got: " << allocator.HeapSize() << std::endl;
+    }
+
+    allocator.Free(block_2);
+    allocator.Free(block_4);
+    allocator.Free(block_6);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_mmap_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_mmap_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(16);
+    auto block_2 = allocator.New(32);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertUsedBlock(block_2_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 16, fail, test_name);
+    AssertAllocatedSize(block_2_header, 32, fail, test_name);
+
+    // Blocks are carved from the same arena one after another.
+    AssertBlocksEqual(NextHeapBlock(block_1_header), block_2_header, fail, test_name);
+    AssertBlocksEqual(GetHeader((MachineWord *)((char *)block_1 + 16 + sizeof(MemoryBlock) - SizeOfData())),
+        block_2_header, fail, test_name);
+
+    // Rest of the arena is left free after the last block.
+    AssertFreeBlock(NextHeapBlock(block_2_header), fail, test_name);
+
+    // Block that doesn't fit into an arena gets its own arena.
+    auto big_size = 4 * 1024 * 1024;
+    auto block_3 = allocator.New(big_size);
+    auto block_3_header = GetHeader(block_3);
+    AssertUsedBlock(block_3_header, fail, test_name);
+    AssertAllocatedSize(block_3_header, big_size, fail, test_name);
+    block_3[big_size / sizeof(MachineWord) - 1] = 42;
+
+    // Free blocks are merged back into a single arena block.
+    allocator.Free(block_2);
+    allocator.Free(block_1);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertBlocksEqual(NextHeapBlock(block_1_header), block_3_header, fail, test_name);
+
+    allocator.Free(block_3);
+    AssertFreeBlock(block_3_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_mmap_2(Allocator& allocator_1, Allocator& allocator_2) {
+    std::string test_name = "TestAllocator_mmap_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator_1);
+
+    MachineWord *blocks_1[100];
+    MachineWord *blocks_2[100];
+
+    // Allocators are independent and can be used at the same time.
+    for (auto i = 0; i < 100; ++i) {
+        blocks_1[i] = allocator_1.New(8 * (i + 1));
+        blocks_2[i] = allocator_2.New(8 * (i + 1));
+        blocks_1[i][i] = i;
+        blocks_2[i][i] = i + 1;
+    }
+
+    for (auto i = 0; i < 100; ++i) {
+        if (blocks_1[i][i] != (MachineWord)i || blocks_2[i][i] != (MachineWord)(i + 1)) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected blocks of different allocators to keep their data" << std::endl;
+        }
+
+        allocator_1.Free(blocks_1[i]);
+    }
+
+    for (auto i = 0; i < 100; ++i) {
+        AssertUsedBlock(GetHeader(blocks_2[i]), fail, test_name);
+        allocator_2.Free(blocks_2[i]);
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_growth_1(Allocator& allocator, size_t growth_size) {
+    std::string test_name = "TestAllocator_growth_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto heap_top = (char *)sbrk(0);
+
+    // All blocks fit into the first growth of the heap.
+    MachineWord *blocks[100];
+    for (auto i = 0; i < 100; ++i) {
+        blocks[i] = allocator.New(64);
+    }
+
+    auto heap_growth = (size_t)((char *)sbrk(0) - heap_top);
+    if (heap_growth != growth_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected heap to grow by " << growth_size
+        << " bytes, but it grew by " << heap_growth << std::endl;
+    }
+
+    // Rest of the growth is left free at the end of the heap.
+    auto last_block_header = GetHeader(blocks[99]);
+    auto tail_header = NextHeapBlock(last_block_header);
+    AssertFreeBlock(tail_header, fail, test_name);
+
+    // Free block at the end of the heap is extended for a block that doesn't
+    // fit into it.
+    auto big_block = allocator.New(2 * growth_size);
+    auto big_block_header = GetHeader(big_block);
+    AssertBlocksEqual(tail_header, big_block_header, fail, test_name);
+    AssertAllocatedSize(big_block_header, 2 * growth_size, fail, test_name);
+    big_block[2 * growth_size / sizeof(MachineWord) - 1] = 42;
+
+    for (auto i = 0; i < 100; ++i) {
+        allocator.Free(blocks[i]);
+    }
+    allocator.Free(big_block);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_growth_2(Allocator& allocator, size_t arena_size) {
+    std::string test_name = "TestAllocator_growth_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Take most of the first arena.
+    auto block_1 = allocator.New(arena_size - 1024);
+    auto block_1_header = GetHeader(block_1);
+
+    // Block that doesn't fit is taken from the second arena which is twice as
+    // big, the rest of it is left free.
+    auto block_2 = allocator.New(arena_size - 1024);
+    auto block_2_header = GetHeader(block_2);
+    AssertFreeBlock(NextHeapBlock(block_2_header), fail, test_name);
+
+    if (NextHeapBlock(block_2_header)->Size < arena_size / 2) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected at least " << arena_size / 2
+        << " free bytes in the second arena, but got: "
+        << NextHeapBlock(block_2_header)->Size << std::endl;
+    }
+
+    // Third block fits into the rest of the second arena.
+    auto block_3 = allocator.New(arena_size / 2);
+    AssertBlocksEqual(NextHeapBlock(block_2_header), GetHeader(block_3), fail, test_name);
+
+    allocator.Free(block_1);
+    allocator.Free(block_2);
+    allocator.Free(block_3);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertFreeBlock(block_2_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_slab_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_slab_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Small objects have no headers and are packed next to each other.
+    auto object_1 = allocator.New(8);
+    auto object_2 = allocator.New(8);
+    auto object_3 = allocator.New(5);
+
+    if (object_2 != object_1 + 1 || object_3 != object_2 + 1) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 8 byte objects next to each other, but got: "
+        << object_1 << ", " << object_2 << ", " << object_3 << std::endl;
+    }
+
+    // Every size class has its own slab.
+    auto object_4 = allocator.New(24);
+    if (allocator.UsableSize(object_4) != 24 || allocator.UsableSize(object_1) != 8) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected usable sizes 24 and 8, but got: " << allocator.UsableSize(object_4)
+        << " and " << allocator.UsableSize(object_1) << std::endl;
+    }
+
+    // Freed object is reused first.
+    allocator.Free(object_2);
+    auto object_5 = allocator.New(8);
+    if (object_5 != object_2) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected freed object " << object_2 << " to be reused, but got: "
+        << object_5 << std::endl;
+    }
+
+    // Objects above the slab size are taken from the blocks.
+    auto block_1 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 256, fail, test_name);
+
+    allocator.Free(block_1);
+    AssertFreeBlock(block_1_header, fail, test_name);
+
+    allocator.Free(object_1);
+    allocator.Free(object_3);
+    allocator.Free(object_4);
+    allocator.Free(object_5);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_slab_2(Allocator& allocator, size_t slab_arena_size) {
+    std::string test_name = "TestAllocator_slab_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+    auto object_count = slab_arena_size / page_size * ((page_size - 64) / 64);
+
+    // Fill the whole slab arena with objects of one size.
+    std::vector<MachineWord *> objects;
+    for (size_t i = 0; i < object_count; ++i) {
+        objects.push_back(allocator.New(64));
+    }
+
+    auto first_slab = (char *)((uintptr_t)objects.front() & ~(uintptr_t)(page_size - 1));
+    auto last_slab = (char *)((uintptr_t)objects.back() & ~(uintptr_t)(page_size - 1));
+
+    if ((size_t)(last_slab - first_slab) != slab_arena_size - page_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected objects in " << slab_arena_size / page_size
+        << " slabs, but got them in: " << (last_slab - first_slab) / page_size + 1 << std::endl;
+    }
+
+    // Object that doesn't fit into the slab arena is taken from the blocks.
+    auto block_1 = allocator.New(64);
+    auto block_1_header = GetHeader(block_1);
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 64, fail, test_name);
+
+    allocator.Free(block_1);
+    AssertFreeBlock(block_1_header, fail, test_name);
+
+    // Empty slabs are reused by other size classes.
+    for (auto object : objects) {
+        allocator.Free(object);
+    }
+
+    auto object_1 = allocator.New(16);
+    if ((char *)object_1 < first_slab || (char *)object_1 >= last_slab + page_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected an object from the emptied slabs, but got: " << object_1 << std::endl;
+    }
+
+    allocator.Free(object_1);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+// IsSlabData reports if the data isn't a block of the heap that starts at the
+// heap_start.
+bool IsSlabData(const MemoryBlock* heap_start, const MachineWord *data) {
+    for (auto curr = heap_start; curr != nullptr; curr = NextHeapBlock(curr)) {
+        if (curr->Data == data) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// AssertStats walks the heap from its first block and compares the blocks
+// with the counters of the allocator. Slab objects aren't in the heap, their
+// number and size are passed by the caller.
+template <typename AllocatorType>
+void AssertStats(const AllocatorType& allocator, const MemoryBlock* heap_start, bool& fail_flag, const std::string& test_name,
+    size_t slab_objects = 0, size_t slab_size = 0) {
+    auto stats = allocator.GetStats();
+    size_t used_blocks = slab_objects, free_blocks = 0, allocated_size = slab_size, free_size = 0, largest = 0;
+
+    for (auto curr = heap_start; curr != nullptr; curr = NextHeapBlock(curr)) {
+        if (curr->Used) {
+            ++used_blocks;
+            allocated_size += curr->Size;
+            continue;
+        }
+
+        ++free_blocks;
+        free_size += curr->Size;
+        if (curr->Size > largest) {
+            largest = curr->Size;
+        }
+    }
+
+    size_t class_blocks = 0;
+    for (auto count : stats.SizeClasses) {
+        class_blocks += count;
+    }
+
+    if (stats.UsedBlocks != used_blocks || stats.AllocatedSize != allocated_size ||
+        stats.FreeBlocks != free_blocks || stats.FreeSize != free_size ||
+        stats.LargestFreeBlock != largest || class_blocks != used_blocks) {
+        fail_flag = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected " << used_blocks << " used blocks of " << allocated_size << " bytes, "
+        << free_blocks << " free blocks of " << free_size << " bytes, the largest " << largest
+        << ", but got: " << stats.UsedBlocks << " (" << class_blocks << " in classes) of "
+        << stats.AllocatedSize << ", " << stats.FreeBlocks << " of " << stats.FreeSize
+        << ", the largest " << stats.LargestFreeBlock << std::endl;
+    }
+}
+
+template <typename AllocatorType>
+void TestAllocator_stats_1(AllocatorType& allocator) {
+    std::string test_name = "TestAllocator_stats_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(16);
+    auto block_1_header = GetHeader(block_1);
+
+    auto stats = allocator.GetStats();
+    if (stats.UsedBlocks != 1 || stats.AllocatedSize != 16 || stats.SizeClasses[1] != 1 ||
+        stats.HeapSize < stats.AllocatedSize + stats.FreeSize) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a single used block of 16 bytes, but got: " << stats.UsedBlocks
+        << " blocks of " << stats.AllocatedSize << " bytes" << std::endl;
+    }
+
+    // Allocate and free blocks of different sizes in a mixed order. Every
+    // third block stays allocated.
+    std::vector<MachineWord *> blocks;
+    size_t seed = 1;
+    for (auto i = 0; i < 300; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        blocks.push_back(allocator.New(8 + (seed >> 33) % 300));
+
+        if (i % 4 == 3) {
+            auto index = (seed >> 40) % blocks.size();
+            allocator.Free(blocks[index]);
+            blocks.erase(blocks.begin() + index);
+        }
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (i % 3 != 0) {
+            allocator.Free(blocks[i]);
+        }
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    stats = allocator.GetStats();
+    if (stats.Searches == 0 || stats.AverageSearchLength <= 0 || stats.Fragmentation < 0 || stats.Fragmentation >= 1) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected searches that visit blocks and fragmentation in [0, 1), but got: "
+        << stats.Searches << " searches of " << stats.AverageSearchLength << " steps, fragmentation "
+        << stats.Fragmentation << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_slab_3(Allocator& allocator) {
+    std::string test_name = "TestAllocator_slab_3";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Slab tier is off, so empty objects are blocks of the heap.
+    auto block_1 = allocator.New(0);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2 = allocator.AlignedNew(0, 16);
+    MachineWord *batch[4];
+    auto allocated = allocator.NewBatch(0, 4, batch);
+
+    if (block_1 == nullptr || block_2 == nullptr || allocated != 4) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected empty objects, but got: " << block_1 << ", " << block_2
+        << " and a batch of " << allocated << std::endl;
+    } else {
+        AssertUsedBlock(block_1_header, fail, test_name);
+
+        if (IsSlabData(block_1_header, block_2) || IsSlabData(block_1_header, batch[0])) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected empty objects in the heap" << std::endl;
+        }
+
+        AssertStats(allocator, block_1_header, fail, test_name);
+
+        allocator.Free(block_2);
+        allocator.FreeBatch(batch, allocated);
+        AssertStats(allocator, block_1_header, fail, test_name);
+    }
+
+    allocator.Free(block_1);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_trim_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_trim_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    auto block_1 = allocator.New(64);
+    auto block_2 = allocator.New(4 * page_size);
+    auto block_3 = allocator.New(8);
+    auto block_4 = allocator.New(1 << 20);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+
+    auto heap_size = allocator.HeapSize();
+
+    // Free block at the end of the heap is returned to the OS and pages
+    // inside the free block_2 are dropped.
+    allocator.Free(block_2);
+    allocator.Free(block_4);
+    auto released = allocator.Trim();
+
+    if (released < (1 << 20) + 3 * page_size || allocator.HeapSize() > heap_size - (1 << 20)) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected at least " << (1 << 20) + 3 * page_size << " released bytes, but got: "
+        << released << ", heap size " << allocator.HeapSize() << " of " << heap_size << std::endl;
+    }
+
+    // Headers of the free blocks stay valid.
+    AssertFreeBlock(block_2_header, fail, test_name);
+    AssertAllocatedSize(block_2_header, 4 * page_size, fail, test_name);
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Trimmed memory can be allocated again.
+    auto block_5 = allocator.New(4 * page_size);
+    auto block_6 = allocator.New(1 << 20);
+    block_5[4 * page_size / sizeof(MachineWord) - 1] = 1;
+    block_6[(1 << 20) / sizeof(MachineWord) - 1] = 1;
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    allocator.Free(block_1);
+    allocator.Free(block_3);
+    allocator.Free(block_5);
+    allocator.Free(block_6);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_trim_2(Allocator& allocator, size_t trim_threshold) {
+    std::string test_name = "TestAllocator_trim_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(64);
+    auto heap_size = allocator.HeapSize();
+
+    // Block above the threshold is trimmed right after Free.
+    auto block_2 = allocator.New(trim_threshold * 4);
+    allocator.Free(block_2);
+
+    if (allocator.HeapSize() > heap_size + trim_threshold) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected heap size below " << heap_size + trim_threshold
+        << ", but got: " << allocator.HeapSize() << std::endl;
+    }
+
+    AssertStats(allocator, GetHeader(block_1), fail, test_name);
+    allocator.Free(block_1);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_trim_3(Allocator& allocator) {
+    std::string test_name = "TestAllocator_trim_3";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    auto block_1 = allocator.New(64);
+    auto block_2 = allocator.New(16 * page_size);
+    auto block_3 = allocator.New(8);
+
+    for (size_t i = 0; i < 16 * page_size / sizeof(MachineWord); ++i) {
+        block_2[i] = i;
+    }
+
+    // Pages inside the free block_2 are dropped only once.
+    allocator.Free(block_2);
+    auto released_1 = allocator.Trim();
+    auto released_2 = allocator.Trim();
+
+    if (released_1 < 14 * page_size || released_2 != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected at least " << 14 * page_size << " and 0 released bytes, but got: "
+        << released_1 << " and " << released_2 << std::endl;
+    }
+
+    // Part that is left after a split of the trimmed block stays trimmed.
+    auto block_4 = allocator.New(64);
+    auto released_3 = allocator.Trim();
+
+    if (released_3 != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 0 released bytes after the split, but got: " << released_3 << std::endl;
+    }
+
+    // Freed block merges with the trimmed one, and the merged block is
+    // trimmed again.
+    allocator.Free(block_4);
+    auto released_4 = allocator.Trim();
+
+    if (released_4 < 14 * page_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected at least " << 14 * page_size << " released bytes after the merge, but got: "
+        << released_4 << std::endl;
+    }
+
+    AssertStats(allocator, GetHeader(block_1), fail, test_name);
+
+    allocator.Free(block_1);
+    allocator.Free(block_3);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_aligned_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_aligned_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t alignments[5] = {16, 32, 64, 4096, page_size * 4};
+    size_t sizes[3] = {8, 100, 5000};
+
+    // First block is bigger than slab objects, it's the start of the heap.
+    auto block_1 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+    std::vector<MachineWord *> blocks;
+
+    // Small data aligned to at most 64 bytes can be a slab object.
+    size_t slab_objects = 0, slab_size = 0;
+
+    for (auto alignment : alignments) {
+        for (auto size : sizes) {
+            auto data = allocator.AlignedNew(size, alignment);
+
+            if ((uintptr_t)data % alignment != 0) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected data aligned to " << alignment << ", but got: " << data << std::endl;
+            }
+
+            if (allocator.UsableSize(data) < size) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected at least " << size << " bytes, but got: " << allocator.UsableSize(data) << std::endl;
+            }
+
+            if (IsSlabData(block_1_header, data)) {
+                ++slab_objects;
+                slab_size += allocator.UsableSize(data);
+            } else {
+                AssertUsedBlock(GetHeader(data), fail, test_name);
+            }
+
+            // Whole data can be used.
+            data[0] = alignment;
+            data[(size - 1) / sizeof(MachineWord)] = alignment;
+
+            blocks.push_back(data);
+        }
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name, slab_objects, slab_size);
+
+    // Leading free blocks can be used by other allocations.
+    auto block_2 = allocator.New(256);
+    AssertUsedBlock(GetHeader(block_2), fail, test_name);
+
+    if (allocator.AlignedNew(8, 24) != nullptr) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a nullptr for the alignment that isn't a power of two" << std::endl;
+    }
+
+    for (auto data : blocks) {
+        allocator.Free(data);
+    }
+    allocator.Free(block_2);
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_aligned_2(Allocator& allocator) {
+    std::string test_name = "TestAllocator_aligned_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Default alignment of malloc and operator new.
+    const size_t alignment = alignof(std::max_align_t);
+
+    auto block_1 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+    std::vector<MachineWord *> blocks;
+    size_t seed = 1;
+
+    // Mixed sizes and frees, so the free blocks are found at any offset.
+    for (auto i = 0; i < 2000; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        auto size = (seed >> 33) % 600;
+        auto data = allocator.AlignedNew(size, alignment);
+
+        if (data == nullptr || (uintptr_t)data % alignment != 0 || allocator.UsableSize(data) < size) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected " << size << " bytes aligned to " << alignment << ", but got: " << data << std::endl;
+            break;
+        }
+
+        blocks.push_back(data);
+
+        if (i % 3 == 2) {
+            auto index = (seed >> 40) % blocks.size();
+            allocator.Free(blocks[index]);
+            blocks.erase(blocks.begin() + index);
+        }
+    }
+
+    for (auto data : blocks) {
+        allocator.Free(data);
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_realloc_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_realloc_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(256);
+    auto block_2 = allocator.New(256);
+    auto block_3 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+    auto block_3_header = GetHeader(block_3);
+
+    // Shrink in place, the end of the block becomes free.
+    auto data = allocator.Realloc(block_2, 200);
+    AssertBlocksEqual(block_2_header, GetHeader(data), fail, test_name);
+    AssertAllocatedSize(block_2_header, 200, fail, test_name);
+    AssertFreeBlock(NextBlock(block_2_header), fail, test_name);
+
+    // Grow in place into the next free block.
+    allocator.Free(block_2);
+    data = allocator.Realloc(block_1, 400);
+    AssertBlocksEqual(block_1_header, GetHeader(data), fail, test_name);
+    AssertAllocatedSize(block_1_header, 400, fail, test_name);
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Grow in place at the end of the heap.
+    data = allocator.Realloc(block_3, 10000);
+    AssertBlocksEqual(block_3_header, GetHeader(data), fail, test_name);
+    AssertAllocatedSize(block_3_header, 10000, fail, test_name);
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Data is copied if the block can't grow.
+    auto block_4 = allocator.New(256);
+    for (auto i = 0; i < 32; ++i) {
+        block_1[i] = i;
+    }
+
+    data = allocator.Realloc(block_1, 20000);
+    for (auto i = 0; i < 32; ++i) {
+        if (data[i] != (MachineWord)i) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected " << i << " in the moved data, but got: " << data[i] << std::endl;
+            break;
+        }
+    }
+    AssertFreeBlock(block_1_header, fail, test_name);
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    allocator.Free(data);
+    allocator.Free(block_3);
+    allocator.Free(block_4);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_realloc_2(Allocator& allocator) {
+    std::string test_name = "TestAllocator_realloc_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Slab objects are moved to blocks when they grow.
+    auto object_1 = allocator.Realloc(nullptr, 24);
+    object_1[0] = 1;
+    object_1[2] = 3;
+
+    if (allocator.Realloc(object_1, 20) != object_1) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected object to keep its address when it shrinks" << std::endl;
+    }
+
+    auto data = allocator.Realloc(object_1, 1000);
+    AssertUsedBlock(GetHeader(data), fail, test_name);
+    if (data[0] != 1 || data[2] != 3) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the object data to be copied, but got: " << data[0] << ", " << data[2] << std::endl;
+    }
+
+    if (allocator.Realloc(data, 0) != nullptr) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a nullptr for the zero size" << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_batch_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_batch_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+
+    // Blocks of the batch are carved one after another.
+    MachineWord *blocks[10];
+    auto count = allocator.NewBatch(200, 10, blocks);
+
+    if (count != 10) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 10 blocks, but got: " << count << std::endl;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        auto header = GetHeader(blocks[i]);
+        AssertUsedBlock(header, fail, test_name);
+        AssertAllocatedSize(header, 200, fail, test_name);
+
+        if (i + 1 < count) {
+            AssertBlocksEqual(NextBlock(header), GetHeader(blocks[i + 1]), fail, test_name);
+        }
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Blocks freed in any order are merged into a single free block.
+    std::swap(blocks[0], blocks[7]);
+    std::swap(blocks[3], blocks[9]);
+    auto first_header = GetHeader(*std::min_element(blocks, blocks + count));
+    allocator.FreeBatch(blocks, count);
+
+    AssertFreeBlock(first_header, fail, test_name);
+    if (first_header->Size < 10 * 200 + 9 * (sizeof(MemoryBlock) - SizeOfData())) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a single free block of the batch, but got: " << first_header->Size << std::endl;
+    }
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Batch is reused from the free block.
+    count = allocator.NewBatch(100, 10, blocks);
+    AssertBlocksEqual(first_header, GetHeader(blocks[0]), fail, test_name);
+    allocator.FreeBatch(blocks, count);
+
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+template <typename AllocatorType>
+void TestAllocator_remote_free_1(AllocatorType& allocator) {
+    std::string test_name = "TestAllocator_remote_free_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(256);
+    auto block_2 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+
+    // Free from another thread doesn't wait for the lock, the block stays
+    // used until the holder of the lock takes it.
+    allocator._mtx.lock();
+    std::thread thread([&]() {
+        allocator.Free(block_1);
+    });
+    thread.join();
+    allocator._mtx.unlock();
+
+    AssertUsedBlock(block_1_header, fail, test_name);
+
+    allocator.Free(block_2);
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    // Every thread frees the blocks allocated by the next one, so frees
+    // contend for the lock.
+    const auto thread_count = 4;
+    const auto block_count = 1000;
+    std::vector<MachineWord *> blocks[thread_count];
+    std::vector<std::thread> threads;
+
+    for (auto t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (auto i = 0; i < block_count; ++i) {
+                blocks[t].push_back(allocator.New(8 * (1 + (i + t) % 32)));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    for (auto t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (auto data : blocks[(t + 1) % thread_count]) {
+                allocator.Free(data);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Take the frees left on the remote list.
+    allocator.Free(allocator.New(8));
+
+    AssertFreeBlock(block_1_header, fail, test_name);
+    AssertStats(allocator, block_1_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestBasicAllocator_1() {
+    std::string test_name = "TestBasicAllocator_1";
+    bool fail = false;
+
+    // Static policies take precedence over the algorithm and the backend
+    // passed to the constructor.
+    using TlsfAllocator = BasicAllocator<TlsfFitPolicy, SpinLock, MmapBacking>;
+
+    TlsfAllocator::Options options;
+    options.Backend = BackendType::SBRK;
+
+    TlsfAllocator allocator(AllocationAlgorithm::FIRST_FIT, options);
+    PrintTestRunning(test_name, allocator);
+
+    auto block_1 = allocator.New(64);
+    if (allocator.Algorithm() != "tlsf fit" || allocator.HeapSize() < options.ArenaSize) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the tlsf fit over an arena of " << options.ArenaSize << " bytes, but got the "
+        << allocator.Algorithm() << " over " << allocator.HeapSize() << " bytes" << std::endl;
+    }
+
+    allocator.Free(block_1);
+
+    // Allocator without a lock works like any other in a single thread.
+    BasicAllocator<BestFitPolicy, NoLock, MmapBacking> unlocked_allocator;
+
+    auto block_2 = unlocked_allocator.New(24);
+    auto block_3 = unlocked_allocator.New(40);
+    unlocked_allocator.Free(block_2);
+    auto block_4 = unlocked_allocator.New(16);
+
+    if (unlocked_allocator.Algorithm() != "best fit" || block_4 != block_2 || unlocked_allocator.UsableSize(block_3) != 40) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the freed block of the best fit to be reused" << std::endl;
+    }
+
+    unlocked_allocator.Free(block_3);
+    unlocked_allocator.Free(block_4);
+    AssertStats(unlocked_allocator, GetHeader(block_2), fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_buffer_1(Allocator& allocator_1, Allocator& allocator_2, size_t buffer_size) {
+    std::string test_name = "TestAllocator_buffer_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator_1);
+
+    auto heap_top = sbrk(0);
+
+    // Allocators over different buffers are independent and can be used at
+    // the same time.
+    std::vector<MachineWord *> blocks_1;
+    std::vector<MachineWord *> blocks_2;
+
+    for (auto i = 0; i < 10; ++i) {
+        blocks_1.push_back(allocator_1.New(8 * (i + 1)));
+        blocks_2.push_back(allocator_2.New(8 * (i + 1)));
+        blocks_1[i][0] = i;
+        blocks_2[i][0] = i + 1;
+    }
+
+    // Allocate until the buffer is used up. Memory error is reported without
+    // growing the heap.
+    MachineWord *data;
+    while ((data = allocator_1.New(256)) != nullptr) {
+        blocks_1.push_back(data);
+    }
+
+    if (allocator_1.New(8 * 1024) != nullptr || allocator_1.HeapSize() > buffer_size ||
+        allocator_1.HeapSize() + 2 * sizeof(MachineWord) < buffer_size || sbrk(0) != heap_top) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a memory error inside the buffer of " << buffer_size << " bytes, but got: "
+        << allocator_1.HeapSize() << " bytes of the heap" << std::endl;
+    }
+
+    for (auto i = 0; i < 10; ++i) {
+        if (blocks_1[i][0] != (MachineWord)i || blocks_2[i][0] != (MachineWord)(i + 1)) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected blocks of different allocators to keep their data" << std::endl;
+        }
+    }
+
+    // Freed space is reused and the whole buffer is a single free block again.
+    auto heap_start = GetHeader(blocks_1[0]);
+    for (auto data : blocks_1) {
+        allocator_1.Free(data);
+    }
+
+    AssertStats(allocator_1, heap_start, fail, test_name);
+    AssertFreeBlock(heap_start, fail, test_name);
+
+    data = allocator_1.New(buffer_size / 2);
+    if (data == nullptr || allocator_1.Trim() != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the freed buffer to be reused and kept by the trim" << std::endl;
+    }
+
+    allocator_1.Free(data);
+    for (auto data : blocks_2) {
+        allocator_2.Free(data);
+    }
+
+    AssertStats(allocator_2, GetHeader(blocks_2[0]), fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+// IsMapped reports if the page of the address is mapped.
+bool IsMapped(const void *address) {
+    auto page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    auto page = (void *)((uintptr_t)address & ~(page_size - 1));
+
+    return msync(page, page_size, MS_ASYNC) == 0;
+}
+
+void TestAllocator_huge_1(Allocator& allocator, size_t huge_threshold) {
+    std::string test_name = "TestAllocator_huge_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    // Huge object doesn't split the heap, small blocks stay adjacent.
+    auto block_1 = allocator.New(256);
+    auto block_2 = allocator.New(huge_threshold);
+    auto block_3 = allocator.New(256);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+
+    AssertBlocksEqual(NextBlock(block_1_header), GetHeader(block_3), fail, test_name);
+    AssertAllocatedSize(block_2_header, huge_threshold, fail, test_name);
+
+    if (!block_2_header->Used || !block_2_header->Fence || allocator.UsableSize(block_2) < huge_threshold) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a huge object of " << huge_threshold << " bytes" << std::endl;
+    }
+
+    auto stats = allocator.GetStats();
+    if (stats.HugeObjects != 1 || stats.HugeSize < huge_threshold || stats.UsedBlocks != 3) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 1 huge object of " << huge_threshold << " bytes in 3 used blocks, but got: "
+        << stats.HugeObjects << " of " << stats.HugeSize << " in " << stats.UsedBlocks << std::endl;
+    }
+
+    // Huge object keeps its data when it grows and moves to the heap when it
+    // shrinks below the threshold.
+    auto words = huge_threshold / sizeof(MachineWord);
+    block_2[0] = 1;
+    block_2[words - 1] = 2;
+
+    auto block_4 = allocator.Realloc(block_2, 4 * huge_threshold);
+    if (block_4[0] != 1 || block_4[words - 1] != 2 || !GetHeader(block_4)->Fence) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a huge object with the data after the growth" << std::endl;
+    }
+
+    auto block_5 = allocator.Realloc(block_4, 1000);
+    if (block_5[0] != 1 || GetHeader(block_5)->Fence || allocator.GetStats().HugeObjects != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a heap block with the data after the shrink" << std::endl;
+    }
+
+    // Aligned huge object.
+    auto block_6 = allocator.AlignedNew(huge_threshold, 64 * 1024);
+    if ((uintptr_t)block_6 % (64 * 1024) != 0 || !GetHeader(block_6)->Fence) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a huge object aligned to 64 KiB, but got: " << block_6 << std::endl;
+    }
+
+    // Huge objects are unmapped right in Free.
+    allocator.Free(block_6);
+    if (IsMapped(block_6) || allocator.GetStats().HugeSize != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the huge object to be unmapped" << std::endl;
+    }
+
+    // Batches of huge objects are mapped one by one.
+    MachineWord *blocks[2];
+    auto count = allocator.NewBatch(huge_threshold, 2, blocks);
+    if (count != 2 || allocator.GetStats().HugeObjects != 2) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a batch of 2 huge objects, but got: " << count << std::endl;
+    }
+    allocator.FreeBatch(blocks, count);
+
+    allocator.Free(block_1);
+    allocator.Free(block_3);
+    allocator.Free(block_5);
+
+    stats = allocator.GetStats();
+    if (stats.HugeObjects != 0 || stats.UsedBlocks != 0 || stats.AllocatedSize != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected no used blocks, but got: " << stats.UsedBlocks << " of " << stats.AllocatedSize << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestAllocator_huge_page_1(Allocator& allocator) {
+    std::string test_name = "TestAllocator_huge_page_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    const size_t huge_page_size = 2 << 20;
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Arena starts at a huge page boundary and is made of whole huge pages.
+    auto block_1 = allocator.New(256);
+    auto object_1 = allocator.New(16);
+    auto block_1_offset = (uintptr_t)GetHeader(block_1) % huge_page_size;
+    auto object_1_offset = (uintptr_t)object_1 % huge_page_size;
+
+    if (block_1_offset >= page_size || object_1_offset >= page_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the arena and the slab arena at huge page boundaries, but got offsets: "
+        << block_1_offset << ", " << object_1_offset << std::endl;
+    }
+
+    auto stats = allocator.GetStats();
+    if (stats.HeapSize < huge_page_size || (stats.HeapSize - page_size) % huge_page_size != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected a heap of whole huge pages and a slab, but got: " << stats.HeapSize << std::endl;
+    }
+
+    // Advice isn't available without transparent huge pages in the kernel.
+    if (stats.HugePageSize != 0 && stats.HugePageSize != stats.HeapSize) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the whole heap of " << stats.HeapSize << " bytes in huge pages, but got: "
+        << stats.HugePageSize << std::endl;
+    }
+
+    // Released arenas leave the huge page size.
+    auto block_2 = allocator.New(3 * huge_page_size);
+    allocator.Free(block_2);
+    allocator.Trim();
+
+    if (allocator.GetStats().HugePageSize != stats.HugePageSize) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected " << stats.HugePageSize << " bytes in huge pages after the trim, but got: "
+        << allocator.GetStats().HugePageSize << std::endl;
+    }
+
+    allocator.Free(block_1);
+    allocator.Free(object_1);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
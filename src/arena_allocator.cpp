@@ -0,0 +1,325 @@
+#pragma once
+
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <new>
+
+#include "allocator.cpp"
+#include "../include/arena_allocator.h"
+
+// Preferred memory policy of mbind, see numaif.h. Pages go to the preferred
+// node while it has free memory and to other nodes after that.
+constexpr int kMemoryPolicyPreferred = 1;
+
+// ArenaAllocator constructor creates arena_count arenas with the same options.
+ArenaAllocator::ArenaAllocator(Allocator::AllocationAlgorithm algorithm, size_t arena_count,
+    ArenaAssignment assignment, const Allocator::Options& options) noexcept :
+assignment_(assignment),
+simulated_nodes_(false),
+page_map_(),
+page_map_size_(0) {
+    if (assignment_ == ArenaAssignment::NUMA_NODE) {
+        auto node_count = SystemNodeCount();
+
+        if (arena_count == 0) {
+            arena_count = node_count;
+        }
+
+        simulated_nodes_ = arena_count > node_count;
+    }
+
+    auto arena_options = options;
+    arena_options.Backend = Allocator::BackendType::MMAP;
+    arena_options.RegionHook = RegionHook;
+    arena_options.RegionHookContext = this;
+
+    if (arena_count == 0) {
+        arena_count = 1;
+    }
+
+    for (size_t i = 0; i < arena_count; ++i) {
+        arenas_.emplace_back(new Allocator(algorithm, arena_options));
+    }
+}
+
+// ArenaAllocator destructor unmaps all arenas and deletes the page map.
+ArenaAllocator::~ArenaAllocator() noexcept {
+    arenas_.clear();
+
+    for (auto& entry : page_map_) {
+        auto node = entry.load(std::memory_order_relaxed);
+        if (node == nullptr) {
+            continue;
+        }
+
+        for (auto& leaf : node->Leaves) {
+            delete leaf.load(std::memory_order_relaxed);
+        }
+
+        delete node;
+    }
+}
+
+// New allocates from the arena of the calling thread. Other arenas are tried
+// in order if it's out of memory.
+MachineWord *ArenaAllocator::New(size_t needed_size) noexcept {
+    auto& arena = LocalArena();
+
+    auto data = arena.New(needed_size);
+    if (data != nullptr) {
+        return data;
+    }
+
+    for (auto& other : arenas_) {
+        if (other.get() != &arena) {
+            data = other->New(needed_size);
+            if (data != nullptr) {
+                return data;
+            }
+        }
+    }
+
+    // Memory error.
+    return nullptr;
+}
+
+// Free returns the data to its arena. A contended arena takes it later from
+// its remote free list.
+void ArenaAllocator::Free(MachineWord *data) noexcept {
+    Owner(data)->Free(data);
+}
+
+// AlignedNew allocates aligned data from the arena of the calling thread.
+MachineWord *ArenaAllocator::AlignedNew(size_t needed_size, size_t alignment) noexcept {
+    return LocalArena().AlignedNew(needed_size, alignment);
+}
+
+// Realloc resizes the data in its arena.
+MachineWord *ArenaAllocator::Realloc(MachineWord *data, size_t needed_size) noexcept {
+    if (data == nullptr) {
+        return New(needed_size);
+    }
+
+    return Owner(data)->Realloc(data, needed_size);
+}
+
+// UsableSize returns the data size of the block.
+size_t ArenaAllocator::UsableSize(const MachineWord *data) const noexcept {
+    return Owner(data)->UsableSize(data);
+}
+
+// ArenaCount returns the number of arenas.
+size_t ArenaAllocator::ArenaCount() const noexcept {
+    return arenas_.size();
+}
+
+// Arena returns the arena by its index.
+Allocator& ArenaAllocator::Arena(size_t index) noexcept {
+    return *arenas_[index];
+}
+
+// Owner looks the page of the data up in the page map.
+Allocator *ArenaAllocator::Owner(const MachineWord *data) const noexcept {
+    auto page = PageIndex(data);
+    if (page == SIZE_MAX) {
+        return nullptr;
+    }
+
+    auto node = page_map_[page >> (2 * kPageMapLevelBits)].load(std::memory_order_acquire);
+    if (node == nullptr) {
+        return nullptr;
+    }
+
+    auto leaf = node->Leaves[(page >> kPageMapLevelBits) & (kPageMapLevelSize - 1)].load(std::memory_order_acquire);
+    if (leaf == nullptr) {
+        return nullptr;
+    }
+
+    return leaf->Owners[page & (kPageMapLevelSize - 1)].load(std::memory_order_acquire);
+}
+
+// SimulatedNodes reports if the NUMA nodes of the arenas are simulated.
+bool ArenaAllocator::SimulatedNodes() const noexcept {
+    return simulated_nodes_;
+}
+
+// SystemNodeCount returns the number of NUMA nodes of the machine from the
+// list of online nodes, like "0-3". Machines without NUMA have a single node.
+size_t ArenaAllocator::SystemNodeCount() noexcept {
+    auto file = fopen("/sys/devices/system/node/online", "r");
+    if (file == nullptr) {
+        return 1;
+    }
+
+    // Last number of the list is the biggest node.
+    size_t node = 0;
+    size_t last_node = 0;
+    int separator;
+
+    while (fscanf(file, "%zu", &node) == 1) {
+        last_node = node;
+
+        separator = fgetc(file);
+        if (separator != ',' && separator != '-') {
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return last_node + 1;
+}
+
+// PageMapSize returns the number of bytes taken by the nodes and the leaves of
+// the page map.
+size_t ArenaAllocator::PageMapSize() const noexcept {
+    return page_map_size_;
+}
+
+// ThreadNumber returns a sequential number of the calling thread.
+size_t ArenaAllocator::ThreadNumber() noexcept {
+    static std::atomic<size_t> next_thread(0);
+    thread_local size_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+
+    return thread;
+}
+
+// RegionHook sets the owner of the pages of a mapped region or clears the
+// owner of an unmapped one. Entries are changed in place, so the page map
+// doesn't grow when the same addresses are mapped again.
+void ArenaAllocator::RegionHook(void *context, Allocator *allocator, void *start, size_t size, bool mapped) noexcept {
+    auto arena_allocator = (ArenaAllocator *)context;
+
+    if (mapped && arena_allocator->assignment_ == ArenaAssignment::NUMA_NODE && !arena_allocator->simulated_nodes_) {
+        BindToNode(start, size, arena_allocator->ArenaIndex(allocator));
+    }
+
+    auto first_page = PageIndex(start);
+    auto last_page = PageIndex((char *)start + size - 1);
+
+    // Region can't be mapped.
+    if (first_page == SIZE_MAX || last_page == SIZE_MAX) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(arena_allocator->page_map_mtx_);
+
+    auto owner = mapped ? allocator : nullptr;
+    PageMapLeaf *leaf = nullptr;
+
+    for (auto page = first_page; page <= last_page; ++page) {
+        if (leaf == nullptr || (page & (kPageMapLevelSize - 1)) == 0) {
+            leaf = arena_allocator->MapLeaf(page);
+
+            // Memory error. Pages of the region have no owner.
+            if (leaf == nullptr) {
+                return;
+            }
+        }
+
+        leaf->Owners[page & (kPageMapLevelSize - 1)].store(owner, std::memory_order_release);
+    }
+}
+
+// PageIndex returns the page number of the address or SIZE_MAX if it's above
+// the range of the page map. Linux maps such addresses only on request.
+size_t ArenaAllocator::PageIndex(const void *address) noexcept {
+    auto page = (uintptr_t)address >> kPageMapPageShift;
+
+    if (page >> (3 * kPageMapLevelBits) != 0) {
+        return SIZE_MAX;
+    }
+
+    return page;
+}
+
+// BindToNode sets the preferred node of the pages of the region with mbind.
+// Pages that are already touched aren't moved. Errors are ignored, the pages
+// are placed by the default policy then.
+// https://man7.org/linux/man-pages/man2/mbind.2.html
+void ArenaAllocator::BindToNode(void *start, size_t size, size_t node) noexcept {
+    unsigned long node_mask[16] = {};
+    auto bits = sizeof(node_mask[0]) * 8;
+
+    if (node >= bits * 16) {
+        return;
+    }
+
+    node_mask[node / bits] = 1UL << (node % bits);
+    syscall(SYS_mbind, start, size, kMemoryPolicyPreferred, node_mask, bits * 16 + 1, 0);
+}
+
+// ArenaIndex returns the index of the arena. Arena that is being created isn't
+// in the list yet and gets the next index.
+size_t ArenaAllocator::ArenaIndex(const Allocator *allocator) const noexcept {
+    for (size_t i = 0; i < arenas_.size(); ++i) {
+        if (arenas_[i].get() == allocator) {
+            return i;
+        }
+    }
+
+    return arenas_.size();
+}
+
+// MapLeaf returns the leaf of the page and adds the missing node and leaf. It
+// expects page_map_mtx_ to be locked.
+ArenaAllocator::PageMapLeaf *ArenaAllocator::MapLeaf(size_t page) noexcept {
+    auto& node_entry = page_map_[page >> (2 * kPageMapLevelBits)];
+    auto node = node_entry.load(std::memory_order_relaxed);
+
+    if (node == nullptr) {
+        node = new (std::nothrow) PageMapNode();
+
+        // Memory error.
+        if (node == nullptr) {
+            return nullptr;
+        }
+
+        page_map_size_ += sizeof(PageMapNode);
+        node_entry.store(node, std::memory_order_release);
+    }
+
+    auto& leaf_entry = node->Leaves[(page >> kPageMapLevelBits) & (kPageMapLevelSize - 1)];
+    auto leaf = leaf_entry.load(std::memory_order_relaxed);
+
+    if (leaf == nullptr) {
+        leaf = new (std::nothrow) PageMapLeaf();
+
+        // Memory error.
+        if (leaf == nullptr) {
+            return nullptr;
+        }
+
+        page_map_size_ += sizeof(PageMapLeaf);
+        leaf_entry.store(leaf, std::memory_order_release);
+    }
+
+    return leaf;
+}
+
+// LocalArena returns the arena of the calling thread.
+Allocator& ArenaAllocator::LocalArena() noexcept {
+    size_t index = ThreadNumber();
+
+    if (assignment_ == ArenaAssignment::CPU) {
+        auto cpu = sched_getcpu();
+
+        // CPU is unknown.
+        if (cpu >= 0) {
+            index = (size_t)cpu;
+        }
+    }
+
+    if (assignment_ == ArenaAssignment::NUMA_NODE && !simulated_nodes_) {
+        unsigned cpu, node;
+
+        // Node is unknown.
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+            index = node;
+        }
+    }
+
+    return *arenas_[index % arenas_.size()];
+}
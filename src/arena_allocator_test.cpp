@@ -0,0 +1,418 @@
+#pragma once
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "allocator_test.cpp"
+#include "arena_allocator.cpp"
+
+// AssertArenasEmpty checks that all arenas have no used blocks. Frees left on
+// the remote free lists are taken first.
+void AssertArenasEmpty(ArenaAllocator& arena_allocator, bool& fail_flag, const std::string& test_name) {
+    for (size_t i = 0; i < arena_allocator.ArenaCount(); ++i) {
+        auto& arena = arena_allocator.Arena(i);
+        arena.Free(arena.New(8));
+
+        auto stats = arena.GetStats();
+        if (stats.UsedBlocks != 0) {
+            fail_flag = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected no used blocks in the arena " << i << ", but got: " << stats.UsedBlocks << std::endl;
+        }
+    }
+}
+
+void TestArenaAllocator_1(Allocator::AllocationAlgorithm algorithm, const Allocator::Options& options) {
+    std::string test_name = "TestArenaAllocator_1";
+    bool fail = false;
+
+    ArenaAllocator arena_allocator(algorithm, 4, ArenaAllocator::ArenaAssignment::ROUND_ROBIN, options);
+    PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+    const auto thread_count = 4;
+    const auto block_count = 1000;
+    std::vector<MachineWord *> blocks[thread_count];
+    Allocator *owners[thread_count] = {};
+    bool thread_fail[thread_count] = {};
+    std::vector<std::thread> threads;
+
+    // Every thread allocates from a single arena.
+    for (auto t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (auto i = 0; i < block_count; ++i) {
+                auto size = 8 * (1 + (i + t) % 64);
+                auto data = arena_allocator.New(size);
+                data[0] = t;
+                blocks[t].push_back(data);
+
+                auto owner = arena_allocator.Owner(data);
+                if (owners[t] == nullptr) {
+                    owners[t] = owner;
+                }
+                if (owner != owners[t] || arena_allocator.UsableSize(data) < (size_t)size) {
+                    thread_fail[t] = true;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    // Threads are given different arenas.
+    if (owners[0] == owners[1] || owners[1] == owners[2] || owners[2] == owners[3]) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected threads to allocate from different arenas" << std::endl;
+    }
+
+    // Every thread frees the blocks of the next one.
+    for (auto t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            auto other = (t + 1) % thread_count;
+            for (auto data : blocks[other]) {
+                if (data[0] != (MachineWord)other) {
+                    thread_fail[t] = true;
+                }
+                arena_allocator.Free(data);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto t = 0; t < thread_count; ++t) {
+        if (thread_fail[t]) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Thread " << t << " found a block of a wrong arena or changed by another thread" << std::endl;
+        }
+    }
+
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    // Data that isn't allocated by the arenas has no owner.
+    MachineWord stack_data = 0;
+    if (arena_allocator.Owner(&stack_data) != nullptr) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected no owner of the stack data" << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestArenaAllocator_2(Allocator::AllocationAlgorithm algorithm) {
+    std::string test_name = "TestArenaAllocator_2";
+    bool fail = false;
+
+    Allocator::Options options;
+    options.ArenaSize = 64 * 1024;
+
+    ArenaAllocator arena_allocator(algorithm, 2, ArenaAllocator::ArenaAssignment::CPU, options);
+    PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+    // Blocks bigger than an arena get their own regions and resized data
+    // stays in its arena.
+    auto block_1 = arena_allocator.New(1 << 20);
+    auto owner = arena_allocator.Owner(block_1);
+    auto block_2 = arena_allocator.Realloc(block_1, 2 << 20);
+    auto block_3 = arena_allocator.AlignedNew(100, 4096);
+
+    if (owner == nullptr || arena_allocator.Owner(block_2) != owner ||
+        arena_allocator.Owner(block_3) == nullptr || (uintptr_t)block_3 % 4096 != 0) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the resized and aligned data to be found in the arenas" << std::endl;
+    }
+
+    arena_allocator.Free(block_2);
+    arena_allocator.Free(block_3);
+
+    // Unmapped regions are removed from the table.
+    owner->Trim();
+    if (arena_allocator.Owner(block_2) != nullptr) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected no owner of the trimmed data" << std::endl;
+    }
+
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestArenaAllocator_3(Allocator::AllocationAlgorithm algorithm) {
+    std::string test_name = "TestArenaAllocator_3";
+    bool fail = false;
+
+    // Arena per node of the machine, bound to its node.
+    {
+        ArenaAllocator arena_allocator(algorithm, 0, ArenaAllocator::ArenaAssignment::NUMA_NODE);
+        PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+        if (arena_allocator.ArenaCount() != ArenaAllocator::SystemNodeCount() || arena_allocator.SimulatedNodes()) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected " << ArenaAllocator::SystemNodeCount() << " arenas of real nodes, but got: "
+            << arena_allocator.ArenaCount() << std::endl;
+        }
+
+        auto block_1 = arena_allocator.New(100 * 1024);
+        auto block_2 = arena_allocator.New(64);
+        block_1[0] = 1;
+        block_2[0] = 2;
+
+        if (arena_allocator.Owner(block_1) == nullptr || block_1[0] != 1 || block_2[0] != 2) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected blocks in the node arenas" << std::endl;
+        }
+
+        arena_allocator.Free(block_1);
+        arena_allocator.Free(block_2);
+
+        AssertArenasEmpty(arena_allocator, fail, test_name);
+    }
+
+    // More nodes than the machine has are simulated, threads are spread over
+    // them and frees go back to the node of the block.
+    auto node_count = ArenaAllocator::SystemNodeCount() + 3;
+    ArenaAllocator arena_allocator(algorithm, node_count, ArenaAllocator::ArenaAssignment::NUMA_NODE);
+
+    if (!arena_allocator.SimulatedNodes()) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected simulated nodes" << std::endl;
+    }
+
+    std::vector<MachineWord *> blocks(node_count);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < node_count; ++t) {
+        threads.emplace_back([&, t]() {
+            blocks[t] = arena_allocator.New(128);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t t = 1; t < node_count; ++t) {
+        if (arena_allocator.Owner(blocks[t]) == arena_allocator.Owner(blocks[t - 1])) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected threads " << t - 1 << " and " << t << " on different nodes" << std::endl;
+        }
+    }
+
+    for (auto data : blocks) {
+        arena_allocator.Free(data);
+    }
+
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestArenaAllocator_4(Allocator::AllocationAlgorithm algorithm) {
+    std::string test_name = "TestArenaAllocator_4";
+    bool fail = false;
+
+    Allocator::Options options;
+    options.ArenaSize = 64 * 1024;
+
+    ArenaAllocator arena_allocator(algorithm, 2, ArenaAllocator::ArenaAssignment::ROUND_ROBIN, options);
+    PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+    // Every block gets its own region that is unmapped by the trim, so the
+    // page map changes twice per iteration.
+    size_t page_map_size = 0;
+
+    for (auto i = 0; i < 2000; ++i) {
+        auto data = arena_allocator.New(1 << 20);
+        auto owner = arena_allocator.Owner(data);
+
+        if (owner == nullptr) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected an owner of the data of the iteration " << i << std::endl;
+            break;
+        }
+
+        arena_allocator.Free(data);
+        owner->Trim();
+
+        if (arena_allocator.Owner(data) != nullptr) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected no owner of the trimmed data of the iteration " << i << std::endl;
+            break;
+        }
+
+        if (i == 999) {
+            page_map_size = arena_allocator.PageMapSize();
+        }
+    }
+
+    // Page map doesn't grow with the number of region changes.
+    if (arena_allocator.PageMapSize() != page_map_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the page map of " << page_map_size << " bytes, but got: "
+        << arena_allocator.PageMapSize() << std::endl;
+    }
+
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestArenaAllocator_5(Allocator::AllocationAlgorithm algorithm) {
+    std::string test_name = "TestArenaAllocator_5";
+    bool fail = false;
+
+    Allocator::Options options;
+    options.HugeThreshold = 256 * 1024;
+
+    ArenaAllocator arena_allocator(algorithm, 2, ArenaAllocator::ArenaAssignment::ROUND_ROBIN, options);
+    PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+    // Every huge object is mapped in New and unmapped in Free, so the page
+    // map changes twice per iteration. Addresses of the first mappings can
+    // still spread over new leaves, so the size is taken after a warm up.
+    auto small_data = arena_allocator.New(64);
+    size_t page_map_size = 0;
+
+    for (auto i = 0; i < 5000; ++i) {
+        auto data = arena_allocator.New(512 * 1024 + i % 64 * 4096);
+        data[0] = i;
+
+        if (arena_allocator.Owner(data) == nullptr || arena_allocator.UsableSize(data) < 512 * 1024) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected an owner of the huge object of the iteration " << i << std::endl;
+            break;
+        }
+
+        arena_allocator.Free(data);
+
+        if (i == 999) {
+            page_map_size = arena_allocator.PageMapSize();
+        }
+    }
+
+    // Page map doesn't grow with the number of huge objects.
+    if (arena_allocator.PageMapSize() != page_map_size) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected the page map of " << page_map_size << " bytes, but got: "
+        << arena_allocator.PageMapSize() << std::endl;
+    }
+
+    arena_allocator.Free(small_data);
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestArenaAllocator_6(Allocator::AllocationAlgorithm algorithm) {
+    std::string test_name = "TestArenaAllocator_6";
+    bool fail = false;
+
+    Allocator::Options options;
+    options.HugeThreshold = 256 * 1024;
+
+    ArenaAllocator arena_allocator(algorithm, 2, ArenaAllocator::ArenaAssignment::ROUND_ROBIN, options);
+    PrintTestRunning(test_name, arena_allocator.Arena(0));
+
+    const auto iterations = 2000;
+    bool thread_fail[2] = {};
+    std::vector<std::thread> threads;
+
+    // First thread moves its huge object with mremap, the second one maps
+    // huge objects in another arena, possibly in the released ranges.
+    threads.emplace_back([&]() {
+        auto data = arena_allocator.New(512 * 1024);
+
+        for (auto i = 0; i < iterations; ++i) {
+            auto size = (i % 2 == 0 ? 4096 : 512) * 1024 + i % 16 * 4096;
+            data = arena_allocator.Realloc(data, size);
+
+            if (data == nullptr || arena_allocator.Owner(data) == nullptr) {
+                thread_fail[0] = true;
+                return;
+            }
+            data[0] = i;
+        }
+
+        arena_allocator.Free(data);
+    });
+    threads.emplace_back([&]() {
+        std::vector<MachineWord *> blocks;
+
+        for (auto i = 0; i < iterations; ++i) {
+            blocks.push_back(arena_allocator.New(512 * 1024 + i % 16 * 4096));
+
+            // Owners of the live objects stay registered.
+            for (auto data : blocks) {
+                if (arena_allocator.Owner(data) == nullptr) {
+                    thread_fail[1] = true;
+                }
+            }
+
+            if (blocks.size() == 8) {
+                for (auto data : blocks) {
+                    arena_allocator.Free(data);
+                }
+                blocks.clear();
+            }
+        }
+
+        for (auto data : blocks) {
+            arena_allocator.Free(data);
+        }
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto t = 0; t < 2; ++t) {
+        if (thread_fail[t]) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Thread " << t << " found a huge object without an owner" << std::endl;
+        }
+    }
+
+    AssertArenasEmpty(arena_allocator, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
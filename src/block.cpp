@@ -13,7 +13,51 @@ size_t SizeOfData() {
     return sizeof(std::declval<MemoryBlock>().Data);
 }
 
+// HeaderSize returns a size of MemoryBlock header.
+size_t HeaderSize() {
+    return sizeof(MemoryBlock) - SizeOfData();
+}
+
+// FenceSize returns a size of the fence block that ends a memory region. Its
+// data keeps a single pointer.
+size_t FenceSize() {
+    return HeaderSize() + sizeof(MachineWord);
+}
+
 // GetHeader returns a header to the needed object.
 MemoryBlock* GetHeader(const MachineWord *data) {
     return (MemoryBlock *)((char *)data + SizeOfData() - sizeof(MemoryBlock));
 }
+
+// GetFreeLinks returns free list links stored in the data of a free block.
+FreeLinks* GetFreeLinks(MemoryBlock *memory_block) {
+    return (FreeLinks *)memory_block->Data;
+}
+
+// NextBlock returns the block that follows the provided one in memory. It can
+// be a fence.
+MemoryBlock* NextBlock(const MemoryBlock *memory_block) {
+    return (MemoryBlock *)((char *)memory_block + HeaderSize() + memory_block->Size);
+}
+
+// PrevBlock returns the block that precedes the provided one in memory or a
+// nullptr for the first block of a region.
+MemoryBlock* PrevBlock(const MemoryBlock *memory_block) {
+    if (memory_block->PrevSize == 0) {
+        return nullptr;
+    }
+
+    return (MemoryBlock *)((char *)memory_block - memory_block->PrevSize - HeaderSize());
+}
+
+// NextHeapBlock returns the next block of the heap. It jumps over the fences
+// to the next regions and returns a nullptr after the last block.
+MemoryBlock* NextHeapBlock(const MemoryBlock *memory_block) {
+    auto next = NextBlock(memory_block);
+
+    while (next != nullptr && next->Fence) {
+        next = (MemoryBlock *)next->Data[0];
+    }
+
+    return next;
+}
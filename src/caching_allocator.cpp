@@ -0,0 +1,270 @@
+#pragma once
+
+#include "allocator.cpp"
+#include "../include/caching_allocator.h"
+
+std::mutex CachingAllocator::caches_mtx_;
+thread_local CachingAllocator::ThreadCaches CachingAllocator::thread_caches_;
+
+// CachingAllocator constructor.
+CachingAllocator::CachingAllocator(Allocator& allocator, size_t cache_size) noexcept :
+allocator_(allocator),
+cache_size_(cache_size),
+caches_(nullptr) {}
+
+// CachingAllocator destructor returns blocks from the caches of all threads to
+// the Allocator.
+CachingAllocator::~CachingAllocator() noexcept {
+    std::lock_guard<std::mutex> lock(caches_mtx_);
+
+    while (caches_ != nullptr) {
+        auto cache = caches_;
+
+        FlushAll(cache);
+        Unregister(cache);
+    }
+}
+
+// ThreadCaches destructor returns blocks of the exiting thread to the owners
+// of its caches.
+CachingAllocator::ThreadCaches::~ThreadCaches() noexcept {
+    std::lock_guard<std::mutex> lock(caches_mtx_);
+
+    for (auto& cache : Caches) {
+        auto owner = cache.Owner.load(std::memory_order_relaxed);
+        if (owner == nullptr) {
+            continue;
+        }
+
+        owner->FlushAll(&cache);
+        owner->Unregister(&cache);
+    }
+}
+
+// New returns a block from the cache of the calling thread. The cache is
+// refilled from the Allocator if it's empty.
+MachineWord *CachingAllocator::New(size_t needed_size) noexcept {
+    auto size = allocator_.AllocationSize(needed_size);
+
+    // Big blocks aren't cached.
+    if (size > kMaxCachedSize) {
+        return allocator_.New(needed_size);
+    }
+
+    auto cache = LocalCache();
+    if (cache == nullptr) {
+        return allocator_.New(needed_size);
+    }
+
+    auto index = ClassIndex(size);
+
+    // Memory error.
+    if (cache->Blocks[index] == nullptr && !Refill(cache, size)) {
+        return nullptr;
+    }
+
+    // Pop the block from the cache.
+    auto data = cache->Blocks[index];
+    cache->Blocks[index] = (MachineWord *)data[0];
+    --cache->Counts[index];
+
+    RecordNew(data, needed_size);
+
+    return data;
+}
+
+// Free puts a block to the cache of the calling thread. Part of the cache is
+// returned to the Allocator if it's full.
+void CachingAllocator::Free(MachineWord *data) noexcept {
+    auto size = allocator_.UsableSize(data);
+
+    // Big blocks aren't cached.
+    if (size > kMaxCachedSize) {
+        allocator_.Free(data);
+        return;
+    }
+
+    auto cache = LocalCache();
+    if (cache == nullptr) {
+        allocator_.Free(data);
+        return;
+    }
+
+    auto index = ClassIndex(size);
+
+    RecordFree(data);
+
+    // Push the block to the cache.
+    data[0] = (MachineWord)cache->Blocks[index];
+    cache->Blocks[index] = data;
+    ++cache->Counts[index];
+
+    if (cache->Counts[index] > cache_size_) {
+        Flush(cache, index, cache->Counts[index] - cache_size_ / 2);
+    }
+}
+
+// ClassIndex returns an index of the cache size class for the aligned size.
+size_t CachingAllocator::ClassIndex(size_t size) noexcept {
+    return size / sizeof(MachineWord) - 1;
+}
+
+// LocalCache returns the cache of the calling thread for this allocator. A new
+// cache is registered on the first call from a thread. It returns a nullptr if
+// the thread has no free caches left.
+CachingAllocator::ThreadCache *CachingAllocator::LocalCache() noexcept {
+    ThreadCache *free_cache = nullptr;
+
+    for (auto& cache : thread_caches_.Caches) {
+        auto owner = cache.Owner.load(std::memory_order_acquire);
+
+        if (owner == this) {
+            return &cache;
+        }
+
+        if (owner == nullptr && free_cache == nullptr) {
+            free_cache = &cache;
+        }
+    }
+
+    if (free_cache == nullptr) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(caches_mtx_);
+
+    for (size_t i = 0; i < kCachedClassCount; ++i) {
+        free_cache->Blocks[i] = nullptr;
+        free_cache->Counts[i] = 0;
+    }
+
+    // Chain the cache to the list of this allocator.
+    free_cache->PrevCache = nullptr;
+    free_cache->NextCache = caches_;
+    if (caches_ != nullptr) {
+        caches_->PrevCache = free_cache;
+    }
+    caches_ = free_cache;
+
+    free_cache->Owner.store(this, std::memory_order_release);
+
+    return free_cache;
+}
+
+// RecordNew records a New call served by the cache to the trace of the
+// Allocator. The trace isn't thread safe, so the mutex is taken only while a
+// trace is set.
+void CachingAllocator::RecordNew(const MachineWord *data, size_t size) noexcept {
+    if (allocator_.trace_.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(allocator_._mtx);
+
+    auto trace = allocator_.trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        trace->RecordNew(data, size);
+    }
+}
+
+// RecordFree records a Free call served by the cache to the trace of the
+// Allocator in the same way.
+void CachingAllocator::RecordFree(const MachineWord *data) noexcept {
+    if (allocator_.trace_.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(allocator_._mtx);
+
+    auto trace = allocator_.trace_.load(std::memory_order_relaxed);
+    if (trace != nullptr) {
+        trace->RecordFree(data);
+    }
+}
+
+// Refill takes a batch of blocks of the provided size from the Allocator under
+// a single lock. It returns false if no blocks can be allocated.
+bool CachingAllocator::Refill(ThreadCache *cache, size_t size) noexcept {
+    MachineWord *blocks[kRefillCount];
+    size_t count;
+
+    {
+        std::lock_guard<std::mutex> lock(allocator_._mtx);
+
+        allocator_.DrainRemoteFrees();
+        count = allocator_.NewBatchLocked(size, kRefillCount, blocks);
+    }
+
+    // Push blocks in reverse order so they are returned in the order of
+    // allocation.
+    auto index = ClassIndex(size);
+    while (count > 0) {
+        --count;
+        blocks[count][0] = (MachineWord)cache->Blocks[index];
+        cache->Blocks[index] = blocks[count];
+        ++cache->Counts[index];
+    }
+
+    return cache->Blocks[index] != nullptr;
+}
+
+// Flush returns count blocks of the size class to the Allocator under a single
+// lock. If another thread holds the lock, the blocks are pushed to the remote
+// free list of the Allocator as a single chain.
+void CachingAllocator::Flush(ThreadCache *cache, size_t index, size_t count) noexcept {
+    if (count == 0 || cache->Blocks[index] == nullptr) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(allocator_._mtx, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // Cached blocks are chained by the first word like the remote free
+        // list, so the first count blocks are cut off as they are.
+        auto first = cache->Blocks[index];
+        auto last = first;
+        --cache->Counts[index];
+
+        while (--count > 0 && last[0] != 0) {
+            last = (MachineWord *)last[0];
+            --cache->Counts[index];
+        }
+
+        cache->Blocks[index] = (MachineWord *)last[0];
+        allocator_.PushRemoteFrees(first, last);
+        return;
+    }
+
+    allocator_.DrainRemoteFrees();
+
+    while (count > 0 && cache->Blocks[index] != nullptr) {
+        auto data = cache->Blocks[index];
+        cache->Blocks[index] = (MachineWord *)data[0];
+        --cache->Counts[index];
+        --count;
+
+        allocator_.FreeLocked(data);
+    }
+}
+
+// FlushAll returns all blocks of the cache to the Allocator.
+void CachingAllocator::FlushAll(ThreadCache *cache) noexcept {
+    for (size_t i = 0; i < kCachedClassCount; ++i) {
+        Flush(cache, i, cache->Counts[i]);
+    }
+}
+
+// Unregister removes the cache from the list of this allocator and makes it
+// available for other allocators. It expects caches_mtx_ to be locked.
+void CachingAllocator::Unregister(ThreadCache *cache) noexcept {
+    if (cache->PrevCache != nullptr) {
+        cache->PrevCache->NextCache = cache->NextCache;
+    } else {
+        caches_ = cache->NextCache;
+    }
+
+    if (cache->NextCache != nullptr) {
+        cache->NextCache->PrevCache = cache->PrevCache;
+    }
+
+    cache->Owner.store(nullptr, std::memory_order_release);
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "allocator_test.cpp"
+#include "caching_allocator.cpp"
+
+void TestCachingAllocator_1(Allocator& allocator) {
+    std::string test_name = "TestCachingAllocator_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    CachingAllocator caching_allocator(allocator);
+
+    auto block_1 = caching_allocator.New(24);
+    auto block_2 = caching_allocator.New(24);
+    auto block_1_header = GetHeader(block_1);
+    auto block_2_header = GetHeader(block_2);
+
+    AssertUsedBlock(block_1_header, fail, test_name);
+    AssertUsedBlock(block_2_header, fail, test_name);
+    AssertAllocatedSize(block_1_header, 24, fail, test_name);
+    AssertAllocatedSize(block_2_header, 24, fail, test_name);
+
+    // Blocks are taken from a batch in the order of allocation.
+    AssertBlocksEqual(NextHeapBlock(block_1_header), block_2_header, fail, test_name);
+
+    // Cached block stays used for the allocator and is reused first.
+    caching_allocator.Free(block_2);
+    AssertUsedBlock(block_2_header, fail, test_name);
+
+    auto block_3 = caching_allocator.New(20);
+    AssertBlocksEqual(block_2_header, GetHeader(block_3), fail, test_name);
+
+    // Big blocks aren't cached.
+    auto block_4 = caching_allocator.New(CachingAllocator::kMaxCachedSize + 1);
+    auto block_4_header = GetHeader(block_4);
+    caching_allocator.Free(block_4);
+    AssertFreeBlock(block_4_header, fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestCachingAllocator_2(Allocator& allocator) {
+    std::string test_name = "TestCachingAllocator_2";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    MachineWord *first_block = nullptr;
+
+    {
+        CachingAllocator caching_allocator(allocator, 4);
+
+        // Fill the cache of another thread, it should be returned to the
+        // allocator when the thread exits.
+        std::thread thread([&]() {
+            MachineWord *blocks[8];
+
+            for (auto i = 0; i < 8; ++i) {
+                blocks[i] = caching_allocator.New(16);
+            }
+            for (auto i = 0; i < 8; ++i) {
+                caching_allocator.Free(blocks[i]);
+            }
+
+            first_block = blocks[0];
+        });
+        thread.join();
+
+        // Blocks of the exited thread are merged back into a single block.
+        AssertFreeBlock(GetHeader(first_block), fail, test_name);
+
+        // Cache of the current thread is returned in the destructor.
+        caching_allocator.Free(caching_allocator.New(16));
+    }
+
+    AssertFreeBlock(GetHeader(first_block), fail, test_name);
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestCachingAllocator_3(Allocator& allocator) {
+    std::string test_name = "TestCachingAllocator_3";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    CachingAllocator caching_allocator(allocator, 8);
+
+    const auto thread_count = 4;
+    const auto block_count = 64;
+    bool thread_fail[thread_count] = {};
+    std::vector<std::thread> threads;
+
+    // Every thread writes its own pattern to the blocks and checks that no
+    // other thread changed it.
+    for (auto t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            MachineWord *blocks[block_count];
+
+            for (auto round = 0; round < 100; ++round) {
+                for (auto i = 0; i < block_count; ++i) {
+                    auto size = 8 * (1 + (i + round) % 32);
+                    blocks[i] = caching_allocator.New(size);
+                    blocks[i][size / 8 - 1] = t;
+                    blocks[i][0] = t;
+                }
+                for (auto i = 0; i < block_count; ++i) {
+                    auto size = 8 * (1 + (i + round) % 32);
+                    if (blocks[i][0] != (MachineWord)t || blocks[i][size / 8 - 1] != (MachineWord)t) {
+                        thread_fail[t] = true;
+                    }
+                    caching_allocator.Free(blocks[i]);
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto t = 0; t < thread_count; ++t) {
+        if (thread_fail[t]) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Thread " << t << " found a block changed by another thread" << std::endl;
+        }
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestCachingAllocator_4(Allocator& allocator) {
+    std::string test_name = "TestCachingAllocator_4";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    CachingAllocator caching_allocator(allocator, 4);
+
+    MachineWord *blocks[8];
+    std::atomic<int> step(0);
+
+    // Flush of a thread that can't take the lock pushes the blocks to the
+    // remote free list of the allocator.
+    std::thread thread([&]() {
+        for (auto i = 0; i < 8; ++i) {
+            blocks[i] = caching_allocator.New(16);
+        }
+
+        step.store(1);
+        while (step.load() != 2) {
+            std::this_thread::yield();
+        }
+
+        for (auto i = 0; i < 8; ++i) {
+            caching_allocator.Free(blocks[i]);
+        }
+
+        step.store(3);
+        while (step.load() != 4) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (step.load() != 1) {
+        std::this_thread::yield();
+    }
+
+    allocator._mtx.lock();
+    step.store(2);
+    while (step.load() != 3) {
+        std::this_thread::yield();
+    }
+    allocator._mtx.unlock();
+
+    // Flushed blocks stay used until the allocator takes the list.
+    AssertUsedBlock(GetHeader(blocks[0]), fail, test_name);
+    allocator.Free(allocator.New(8));
+    AssertFreeBlock(GetHeader(blocks[0]), fail, test_name);
+
+    step.store(4);
+    thread.join();
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestCachingAllocator_5(Allocator& allocator) {
+    std::string test_name = "TestCachingAllocator_5";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    std::string path = "/tmp/caching_allocator_trace_test.bin";
+
+    {
+        CachingAllocator caching_allocator(allocator, 2);
+        AllocationTrace trace(path);
+        allocator.SetTrace(&trace);
+
+        // Refills and flushes of the cache aren't calls of the program, only
+        // the cached New and Free calls are recorded.
+        auto block_1 = caching_allocator.New(24);
+        auto block_2 = caching_allocator.New(24);
+        auto block_3 = caching_allocator.New(24);
+        caching_allocator.Free(block_1);
+        caching_allocator.Free(block_2);
+        caching_allocator.Free(block_3);
+        caching_allocator.Free(caching_allocator.New(24));
+
+        allocator.SetTrace(nullptr);
+    }
+
+    std::vector<TraceRecord> records;
+    if (!ReadTrace(path, records) || records.size() != 8) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected 8 records in the trace, but got: " << records.size() << std::endl;
+    } else {
+        TraceOperation operations[8] = {
+            TraceOperation::NEW, TraceOperation::NEW, TraceOperation::NEW, TraceOperation::FREE,
+            TraceOperation::FREE, TraceOperation::FREE, TraceOperation::NEW, TraceOperation::FREE
+        };
+        uint64_t sizes[8] = {24, 24, 24, 0, 0, 0, 24, 0};
+
+        for (auto i = 0; i < 8; ++i) {
+            if (records[i].Operation != operations[i] || records[i].Size != sizes[i]) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Unexpected record " << i << ": id " << records[i].Id
+                << ", size " << records[i].Size << std::endl;
+            }
+        }
+    }
+
+    remove(path.c_str());
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
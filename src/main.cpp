@@ -1,50 +1,93 @@
 #include "allocator_test.cpp"
+#include "caching_allocator_test.cpp"
+#include "allocation_trace_test.cpp"
+#include "std_allocator_test.cpp"
+#include "arena_allocator_test.cpp"
 #include "allocator_benchmark.cpp"
 
-int main() {
+// Run tests and a short benchmark, or only the benchmark with --benchmark and
+// the options described in ParseBenchmarkArgs.
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        BenchmarkOptions options;
+        options.Sizes = SmallSizes();
+        options.SizesName = "small";
+        auto format = BenchmarkFormat::TEXT;
+
+        if (!ParseBenchmarkArgs(argc, argv, options, format)) {
+            return 1;
+        }
+
+        if (options.TracePath.empty()) {
+            PrintBenchmarkResults(RunBenchmarkSuite(options), format, std::cout);
+            return 0;
+        }
+
+        std::vector<ReplayResult> results;
+        if (!RunReplaySuite(options.TracePath, results)) {
+            std::cerr << "Can't read the trace: " << options.TracePath << std::endl;
+            return 1;
+        }
+
+        PrintReplayResults(results, format, std::cout);
+
+        return 0;
+    }
+
     // Create aliases for enum values.
-    Allocator::AllocationAlgorithm algorithms[3] = {
+    Allocator::AllocationAlgorithm all_algorithms[6] = {
         Allocator::AllocationAlgorithm::FIRST_FIT,
         Allocator::AllocationAlgorithm::NEXT_FIT,
         Allocator::AllocationAlgorithm::BEST_FIT,
+        Allocator::AllocationAlgorithm::SEGREGATED_FIT,
+        Allocator::AllocationAlgorithm::EXPLICIT_FIT,
+        Allocator::AllocationAlgorithm::TLSF_FIT,
     };
 
     // Run common tests for all allocator algorithms.
-    for (auto i = 0; i < 3; ++i) {
+    for (auto algorithm : all_algorithms) {
         // Tests are running in different scope to check if we have any memory
         // errors in the allocator destructor.
         {
-            auto allocator = Allocator(algorithms[i]);
+            auto allocator = Allocator(algorithm);
             TestAlign(allocator);
         }
         {
-            auto allocator = Allocator(algorithms[i]);
-            TestAllocator_common_1(allocator);
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_1(allocator, MinDataSize(algorithm));
         }
         {
-            auto allocator = Allocator(algorithms[i]);
-            TestAllocator_common_2(allocator);
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_2(allocator, MinDataSize(algorithm));
         }
         {
-            auto allocator = Allocator(algorithms[i]);
+            auto allocator = Allocator(algorithm);
             TestAllocator_common_3(allocator);
         }
         {
-            auto allocator = Allocator(algorithms[i]);
+            auto allocator = Allocator(algorithm);
             TestAllocator_common_4(allocator);
         }
         {
-            auto allocator = Allocator(algorithms[i]);
-            TestAllocator_common_5(allocator);
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_5(allocator, MinDataSize(algorithm));
         }
         {
-            auto allocator = Allocator(algorithms[i]);
-            TestAllocator_common_6(allocator);
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_6(allocator, MinDataSize(algorithm));
         }
         {
-            auto allocator = Allocator(algorithms[i]);
+            auto allocator = Allocator(algorithm);
             TestAllocator_common_7(allocator);
         }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_8(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_common_9(allocator);
+        }
     }
 
     // Run the specific next-fit algorithm tests.
@@ -63,33 +106,302 @@ int main() {
         TestAllocator_best_fit_1(allocator);
     }
 
-    // Run allocation benchmarks.
+    // Run the specific segregated-fit algorithm tests.
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::FIRST_FIT);
-        BenchmarkAllocate(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::SEGREGATED_FIT);
+        TestAllocator_common_8(allocator);
     }
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::NEXT_FIT);
-        BenchmarkAllocate(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::SEGREGATED_FIT);
+        TestAllocator_segregated_fit_1(allocator);
     }
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::BEST_FIT);
-        BenchmarkAllocate(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::SEGREGATED_FIT);
+        TestAllocator_segregated_fit_2(allocator);
     }
 
-    // Run allocation and free benchmarks.
+    // Run the specific explicit-fit algorithm tests.
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::FIRST_FIT);
-        BenchmarkAllocateFree(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::EXPLICIT_FIT);
+        TestAllocator_common_8(allocator);
     }
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::NEXT_FIT);
-        BenchmarkAllocateFree(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::EXPLICIT_FIT);
+        TestAllocator_explicit_fit_1(allocator);
     }
+
+    // Run the specific tlsf-fit algorithm tests.
     {
-        auto allocator = Allocator(Allocator::AllocationAlgorithm::BEST_FIT);
-        BenchmarkAllocateFree(allocator);
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT);
+        TestAllocator_common_8(allocator);
+    }
+    {
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT);
+        TestAllocator_tlsf_fit_1(allocator);
+    }
+    {
+        auto allocator = Allocator(Allocator::AllocationAlgorithm::TLSF_FIT);
+        TestAllocator_tlsf_fit_2(allocator);
+    }
+
+    // Run the mmap backend tests for all allocator algorithms.
+    Allocator::Options mmap_options;
+    mmap_options.Backend = Allocator::BackendType::MMAP;
+    mmap_options.ArenaSize = 64 * 1024;
+
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm, mmap_options);
+            TestAllocator_mmap_1(allocator);
+        }
+        {
+            auto allocator_1 = Allocator(algorithm, mmap_options);
+            auto allocator_2 = Allocator(algorithm, mmap_options);
+            TestAllocator_mmap_2(allocator_1, allocator_2);
+        }
+    }
+
+    // Run the buffer tests for all allocator algorithms. Buffers are stack
+    // arrays, every allocator has its own.
+    for (auto algorithm : all_algorithms) {
+        const size_t buffer_size = 64 * 1024;
+        MachineWord buffer_1[buffer_size / sizeof(MachineWord)];
+        MachineWord buffer_2[buffer_size / sizeof(MachineWord)];
+
+        auto allocator_1 = Allocator(algorithm, buffer_1, buffer_size);
+        auto allocator_2 = Allocator(algorithm, buffer_2, buffer_size, mmap_options);
+        TestAllocator_buffer_1(allocator_1, allocator_2, buffer_size);
+    }
+
+    // Run the heap growth tests for all allocator algorithms.
+    Allocator::Options growth_options;
+    growth_options.GrowthSize = 64 * 1024;
+
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm, growth_options);
+            TestAllocator_growth_1(allocator, growth_options.GrowthSize);
+        }
+        {
+            auto allocator = Allocator(algorithm, mmap_options);
+            TestAllocator_growth_2(allocator, mmap_options.ArenaSize);
+        }
+    }
+
+    // Run the slab tier tests for all allocator algorithms.
+    Allocator::Options slab_options;
+    slab_options.SlabMaxSize = 128;
+    slab_options.SlabArenaSize = 4 * sysconf(_SC_PAGESIZE);
+
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestAllocator_slab_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestAllocator_slab_2(allocator, slab_options.SlabArenaSize);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_slab_3(allocator);
+        }
+    }
+
+    // Run the caching allocator tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestCachingAllocator_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestCachingAllocator_2(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestCachingAllocator_3(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestCachingAllocator_3(allocator);
+        }
     }
 
+    // Run the stats tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        auto allocator = Allocator(algorithm);
+        TestAllocator_stats_1(allocator);
+    }
+
+    // Run the trim tests for all allocator algorithms and both backends.
+    Allocator::Options trim_options;
+    trim_options.TrimThreshold = 64 * 1024;
+
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_trim_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, mmap_options);
+            TestAllocator_trim_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_trim_3(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, mmap_options);
+            TestAllocator_trim_3(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, trim_options);
+            TestAllocator_trim_2(allocator, trim_options.TrimThreshold);
+        }
+    }
+
+    // Run the aligned allocation tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_aligned_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestAllocator_aligned_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_aligned_2(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestAllocator_aligned_2(allocator);
+        }
+    }
+
+    // Run the realloc tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_realloc_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestAllocator_realloc_2(allocator);
+        }
+    }
+
+    // Run the batch tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        auto allocator = Allocator(algorithm);
+        TestAllocator_batch_1(allocator);
+    }
+
+    // Run the remote free tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocator_remote_free_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestCachingAllocator_4(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestCachingAllocator_5(allocator);
+        }
+    }
+
+    // Run the arena allocator tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        TestArenaAllocator_1(algorithm, Allocator::Options());
+        TestArenaAllocator_1(algorithm, slab_options);
+        TestArenaAllocator_2(algorithm);
+        TestArenaAllocator_3(algorithm);
+        TestArenaAllocator_4(algorithm);
+        TestArenaAllocator_5(algorithm);
+        TestArenaAllocator_6(algorithm);
+    }
+
+    // Run the huge object tests for all allocator algorithms.
+    Allocator::Options huge_options;
+    huge_options.HugeThreshold = 256 * 1024;
+
+    Allocator::Options huge_page_options = huge_options;
+    huge_page_options.HugeObjectPages = true;
+
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm, huge_options);
+            TestAllocator_huge_1(allocator, huge_options.HugeThreshold);
+        }
+        {
+            auto allocator = Allocator(algorithm, huge_page_options);
+            TestAllocator_huge_1(allocator, huge_page_options.HugeThreshold);
+        }
+    }
+
+    // Run the huge page region tests for all allocator algorithms.
+    Allocator::Options huge_page_region_options;
+    huge_page_region_options.Backend = Allocator::BackendType::MMAP;
+    huge_page_region_options.SlabMaxSize = 128;
+    huge_page_region_options.HugePageRegions = true;
+
+    for (auto algorithm : all_algorithms) {
+        auto allocator = Allocator(algorithm, huge_page_region_options);
+        TestAllocator_huge_page_1(allocator);
+    }
+
+    // Run the standard library adapter tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestFreeListStdAllocator_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm, slab_options);
+            TestFreeListMemoryResource_1(allocator);
+        }
+    }
+
+    // Run the trace tests for all allocator algorithms.
+    for (auto algorithm : all_algorithms) {
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocationTrace_1(allocator);
+        }
+        {
+            auto allocator = Allocator(algorithm);
+            TestAllocationTrace_2(allocator);
+        }
+    }
+
+    // Run the policy tests for the static fit, lock and backing policies.
+    TestBasicAllocator_1();
+    {
+        BasicAllocator<TlsfFitPolicy, SpinLock, MmapBacking> allocator;
+        TestAllocator_stats_1(allocator);
+    }
+    {
+        BasicAllocator<FirstFitPolicy, NoLock, SbrkBacking> allocator;
+        TestAllocator_stats_1(allocator);
+    }
+    {
+        std::vector<MachineWord> buffer(256 * 1024 / sizeof(MachineWord));
+        BasicAllocator<TlsfFitPolicy, NoLock, BufferBacking> allocator(
+            AllocationAlgorithm::TLSF_FIT, buffer.data(), buffer.size() * sizeof(MachineWord));
+        TestAllocator_stats_1(allocator);
+    }
+    {
+        BasicAllocator<SegregatedFitPolicy, SpinLock, SbrkBacking> allocator;
+        TestAllocator_remote_free_1(allocator);
+    }
+
+    // Run allocation benchmarks for all workloads.
+    BenchmarkAllocators(10000);
+
     return 0;
 }
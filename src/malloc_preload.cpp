@@ -0,0 +1,388 @@
+// malloc_preload replaces malloc, free and the global operator new and delete
+// of a process with a process-wide Allocator. It's built as a shared library
+// and loaded with LD_PRELOAD, see the README. It isn't a part of the unity
+// build of main.cpp.
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+#include "allocator.cpp"
+
+#define PRELOAD_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace {
+
+// InitState is the state of the process-wide Allocator.
+enum class InitState : int {
+    NONE,
+    RUNNING,
+    DONE
+};
+
+// Bootstrap buffer serves allocations made while the Allocator is being
+// created, for example by pthread_atfork. Its blocks are never freed.
+constexpr size_t kBootstrapSize = 64 * 1024;
+
+// Default alignment of malloc and operator new, 16 bytes on x86-64. Allocator
+// aligns data only to the machine word, so bigger alignment goes through
+// AlignedNew.
+constexpr size_t kDefaultAlignment = alignof(std::max_align_t);
+
+alignas(16) char bootstrap_buffer[kBootstrapSize];
+std::atomic<size_t> bootstrap_used(0);
+
+alignas(Allocator) char allocator_storage[sizeof(Allocator)];
+std::atomic<InitState> init_state(InitState::NONE);
+thread_local bool initializing __attribute__((tls_model("initial-exec"))) = false;
+
+// IsBootstrap reports if the data was allocated from the bootstrap buffer.
+bool IsBootstrap(const void *data) noexcept {
+    return data >= bootstrap_buffer && data < bootstrap_buffer + kBootstrapSize;
+}
+
+// BootstrapNew bumps the bootstrap buffer. The size is kept in the word before
+// the data so realloc and malloc_usable_size work for bootstrap blocks too.
+void *BootstrapNew(size_t size, size_t alignment) noexcept {
+    if (alignment < 16) {
+        alignment = 16;
+    }
+
+    auto used = bootstrap_used.load(std::memory_order_relaxed);
+    size_t start;
+
+    do {
+        start = (used + sizeof(MachineWord) + alignment - 1) & ~(alignment - 1);
+
+        // Memory error.
+        if (size > kBootstrapSize || start > kBootstrapSize - size) {
+            return nullptr;
+        }
+    } while (!bootstrap_used.compare_exchange_weak(used, start + size, std::memory_order_relaxed));
+
+    auto data = bootstrap_buffer + start;
+    ((MachineWord *)data)[-1] = size;
+
+    return data;
+}
+
+// BootstrapSize returns the size of a bootstrap block.
+size_t BootstrapSize(const void *data) noexcept {
+    return ((const MachineWord *)data)[-1];
+}
+
+// ProcessAllocator returns the process-wide Allocator or a nullptr while it's
+// being created by the calling thread. The first call creates it, other
+// threads wait until it's ready. The Allocator is never destroyed, so memory
+// freed by static destructors and exiting threads is still valid.
+Allocator *ProcessAllocator() noexcept {
+    if (init_state.load(std::memory_order_acquire) == InitState::DONE) {
+        return (Allocator *)allocator_storage;
+    }
+
+    // Reentrant call from the creation of the Allocator.
+    if (initializing) {
+        return nullptr;
+    }
+
+    auto state = InitState::NONE;
+    if (init_state.compare_exchange_strong(state, InitState::RUNNING, std::memory_order_acquire)) {
+        initializing = true;
+
+        // MMAP backend leaves sbrk to the rest of the process. Algorithm can
+        // be changed with FREELIST_ALGORITHM to compare the fits.
+        Allocator::Options options;
+        options.Backend = Allocator::BackendType::MMAP;
+        options.SlabMaxSize = 128;
+        options.HugeThreshold = 1 << 20;
+
+        auto algorithm = Allocator::AllocationAlgorithm::TLSF_FIT;
+        auto name = getenv("FREELIST_ALGORITHM");
+
+        if (name != nullptr) {
+            if (strcmp(name, "first") == 0) {
+                algorithm = Allocator::AllocationAlgorithm::FIRST_FIT;
+            } else if (strcmp(name, "next") == 0) {
+                algorithm = Allocator::AllocationAlgorithm::NEXT_FIT;
+            } else if (strcmp(name, "best") == 0) {
+                algorithm = Allocator::AllocationAlgorithm::BEST_FIT;
+            } else if (strcmp(name, "segregated") == 0) {
+                algorithm = Allocator::AllocationAlgorithm::SEGREGATED_FIT;
+            } else if (strcmp(name, "explicit") == 0) {
+                algorithm = Allocator::AllocationAlgorithm::EXPLICIT_FIT;
+            }
+        }
+
+        auto allocator = new (allocator_storage) Allocator(algorithm, options);
+
+        // Keep the heap consistent in the child of a fork.
+        pthread_atfork(
+            []() { ((Allocator *)allocator_storage)->_mtx.lock(); },
+            []() { ((Allocator *)allocator_storage)->_mtx.unlock(); },
+            []() { new (&((Allocator *)allocator_storage)->_mtx) std::mutex(); });
+
+        initializing = false;
+        init_state.store(InitState::DONE, std::memory_order_release);
+
+        return allocator;
+    }
+
+    while (init_state.load(std::memory_order_acquire) != InitState::DONE) {
+        sched_yield();
+    }
+
+    return (Allocator *)allocator_storage;
+}
+
+// New allocates aligned data of at least one byte and sets errno on a memory
+// error.
+void *New(size_t size, size_t alignment) noexcept {
+    if (size == 0) {
+        size = 1;
+    }
+
+    auto allocator = ProcessAllocator();
+    void *data;
+
+    if (allocator == nullptr) {
+        data = BootstrapNew(size, alignment);
+    } else if (alignment <= sizeof(MachineWord)) {
+        data = allocator->New(size);
+    } else {
+        data = allocator->AlignedNew(size, alignment);
+    }
+
+    // Memory error.
+    if (data == nullptr) {
+        errno = ENOMEM;
+    }
+
+    return data;
+}
+
+// Free frees data of any origin. Bootstrap blocks are left as they are.
+void Free(void *data) noexcept {
+    if (data == nullptr || IsBootstrap(data)) {
+        return;
+    }
+
+    ProcessAllocator()->Free((MachineWord *)data);
+}
+
+// NewOrThrow implements the throwing operator new: it calls the new handler
+// until the allocation succeeds and throws std::bad_alloc if there's none.
+void *NewOrThrow(size_t size, size_t alignment) {
+    for (;;) {
+        auto data = New(size, alignment);
+        if (data != nullptr) {
+            return data;
+        }
+
+        auto handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        handler();
+    }
+}
+
+}
+
+PRELOAD_EXPORT void *malloc(size_t size) noexcept {
+    return New(size, kDefaultAlignment);
+}
+
+PRELOAD_EXPORT void free(void *data) noexcept {
+    Free(data);
+}
+
+PRELOAD_EXPORT void *calloc(size_t count, size_t size) noexcept {
+    // Overflow.
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    auto data = New(count * size, kDefaultAlignment);
+
+    // Freed blocks keep their data, so memory is cleared even if it's fresh.
+    if (data != nullptr) {
+        memset(data, 0, count * size);
+    }
+
+    return data;
+}
+
+PRELOAD_EXPORT void *realloc(void *data, size_t size) noexcept {
+    if (data == nullptr) {
+        return New(size, kDefaultAlignment);
+    }
+
+    if (size == 0) {
+        Free(data);
+        return nullptr;
+    }
+
+    // Bootstrap blocks can't grow, they are copied to the Allocator.
+    if (IsBootstrap(data)) {
+        auto new_data = New(size, kDefaultAlignment);
+        if (new_data != nullptr) {
+            auto old_size = BootstrapSize(data);
+            memcpy(new_data, data, old_size < size ? old_size : size);
+        }
+
+        return new_data;
+    }
+
+    auto new_data = ProcessAllocator()->Realloc((MachineWord *)data, size, kDefaultAlignment);
+
+    // Memory error. Old data stays valid.
+    if (new_data == nullptr) {
+        errno = ENOMEM;
+    }
+
+    return new_data;
+}
+
+PRELOAD_EXPORT int posix_memalign(void **data, size_t alignment, size_t size) noexcept {
+    // Alignment should be a power of two multiple of the pointer size.
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    auto saved_errno = errno;
+    auto new_data = New(size, alignment);
+    errno = saved_errno;
+
+    if (new_data == nullptr) {
+        return ENOMEM;
+    }
+
+    *data = new_data;
+
+    return 0;
+}
+
+PRELOAD_EXPORT void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return New(size, alignment);
+}
+
+PRELOAD_EXPORT void *memalign(size_t alignment, size_t size) noexcept {
+    return aligned_alloc(alignment, size);
+}
+
+PRELOAD_EXPORT void *valloc(size_t size) noexcept {
+    return New(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+PRELOAD_EXPORT void *pvalloc(size_t size) noexcept {
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    return New((size + page_size - 1) & ~(page_size - 1), page_size);
+}
+
+PRELOAD_EXPORT size_t malloc_usable_size(void *data) noexcept {
+    if (data == nullptr) {
+        return 0;
+    }
+
+    if (IsBootstrap(data)) {
+        return BootstrapSize(data);
+    }
+
+    return ProcessAllocator()->UsableSize((MachineWord *)data);
+}
+
+// Global operator new and delete. Sized delete ignores the size, the Allocator
+// knows the size of every block.
+void *operator new(size_t size) {
+    return NewOrThrow(size, kDefaultAlignment);
+}
+
+void *operator new[](size_t size) {
+    return NewOrThrow(size, kDefaultAlignment);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    return New(size, kDefaultAlignment);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return New(size, kDefaultAlignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return NewOrThrow(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return NewOrThrow(size, (size_t)alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return New(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return New(size, (size_t)alignment);
+}
+
+void operator delete(void *data) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data) noexcept {
+    Free(data);
+}
+
+void operator delete(void *data, size_t) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data, size_t) noexcept {
+    Free(data);
+}
+
+void operator delete(void *data, const std::nothrow_t&) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data, const std::nothrow_t&) noexcept {
+    Free(data);
+}
+
+void operator delete(void *data, std::align_val_t) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data, std::align_val_t) noexcept {
+    Free(data);
+}
+
+void operator delete(void *data, size_t, std::align_val_t) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data, size_t, std::align_val_t) noexcept {
+    Free(data);
+}
+
+void operator delete(void *data, std::align_val_t, const std::nothrow_t&) noexcept {
+    Free(data);
+}
+
+void operator delete[](void *data, std::align_val_t, const std::nothrow_t&) noexcept {
+    Free(data);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "allocator.cpp"
+#include "../include/std_allocator.h"
+
+// FreeListMemoryResource constructor.
+FreeListMemoryResource::FreeListMemoryResource(Allocator& allocator) noexcept :
+allocator_(allocator) {}
+
+// do_allocate returns aligned space of the provided size. It throws
+// std::bad_alloc on a memory error as memory_resource requires.
+void *FreeListMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+    auto data = allocator_.AlignedNew(bytes, alignment);
+
+    // Memory error.
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return data;
+}
+
+// do_deallocate frees space returned by do_allocate.
+void FreeListMemoryResource::do_deallocate(void *data, size_t, size_t) {
+    allocator_.Free((MachineWord *)data);
+}
+
+// do_is_equal reports if the other resource allocates from the same Allocator.
+bool FreeListMemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    auto other_resource = dynamic_cast<const FreeListMemoryResource *>(&other);
+
+    return other_resource != nullptr && &other_resource->allocator_ == &allocator_;
+}
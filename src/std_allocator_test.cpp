@@ -0,0 +1,126 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "allocator_test.cpp"
+#include "std_allocator.cpp"
+
+// CacheLine is a type that needs the cache line alignment.
+struct alignas(64) CacheLine {
+    MachineWord Value;
+};
+
+void TestFreeListStdAllocator_1(Allocator& allocator) {
+    std::string test_name = "TestFreeListStdAllocator_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    auto used_blocks = allocator.GetStats().UsedBlocks;
+
+    {
+        std::vector<int, FreeListStdAllocator<int>> numbers{FreeListStdAllocator<int>(allocator)};
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+            FreeListStdAllocator<std::pair<const int, int>>> squares{FreeListStdAllocator<int>(allocator)};
+        std::vector<CacheLine, FreeListStdAllocator<CacheLine>> lines{FreeListStdAllocator<CacheLine>(allocator)};
+
+        for (auto i = 0; i < 1000; ++i) {
+            numbers.push_back(i);
+            squares[i] = i * i;
+            lines.push_back({(MachineWord)i});
+        }
+
+        for (auto i = 0; i < 1000; ++i) {
+            if (numbers[i] != i || squares[i] != i * i || lines[i].Value != (MachineWord)i) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected " << i << " in the containers, but got: " << numbers[i]
+                << ", " << squares[i] << ", " << lines[i].Value << std::endl;
+                break;
+            }
+        }
+
+        if ((uintptr_t)lines.data() % alignof(CacheLine) != 0) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected data aligned to " << alignof(CacheLine) << ", but got: " << lines.data() << std::endl;
+        }
+
+        if (allocator.GetStats().UsedBlocks <= used_blocks) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected containers to allocate from the allocator" << std::endl;
+        }
+    }
+
+    // Containers free all their memory.
+    if (allocator.GetStats().UsedBlocks != used_blocks) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected " << used_blocks << " used blocks, but got: "
+        << allocator.GetStats().UsedBlocks << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}
+
+void TestFreeListMemoryResource_1(Allocator& allocator) {
+    std::string test_name = "TestFreeListMemoryResource_1";
+    bool fail = false;
+    PrintTestRunning(test_name, allocator);
+
+    FreeListMemoryResource resource(allocator);
+    auto used_blocks = allocator.GetStats().UsedBlocks;
+
+    {
+        std::pmr::vector<std::pmr::string> strings(&resource);
+
+        for (auto i = 0; i < 100; ++i) {
+            strings.emplace_back(std::string(i, 'a'));
+        }
+
+        for (auto i = 0; i < 100; ++i) {
+            if (strings[i].size() != (size_t)i || strings[i].get_allocator().resource() != &resource) {
+                fail = true;
+                PrintTestFail(test_name);
+                std::cerr << "Expected a string of " << i << " bytes from the resource, but got: "
+                << strings[i].size() << std::endl;
+                break;
+            }
+        }
+
+        auto data = resource.allocate(100, 4096);
+        if ((uintptr_t)data % 4096 != 0) {
+            fail = true;
+            PrintTestFail(test_name);
+            std::cerr << "Expected data aligned to 4096, but got: " << data << std::endl;
+        }
+        resource.deallocate(data, 100, 4096);
+    }
+
+    if (allocator.GetStats().UsedBlocks != used_blocks) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected " << used_blocks << " used blocks, but got: "
+        << allocator.GetStats().UsedBlocks << std::endl;
+    }
+
+    FreeListMemoryResource other_resource(allocator);
+    if (!resource.is_equal(other_resource)) {
+        fail = true;
+        PrintTestFail(test_name);
+        std::cerr << "Expected resources of the same allocator to be equal" << std::endl;
+    }
+
+    if (!fail) {
+        PrintTestPass(test_name);
+    }
+
+    std::cout << std::endl;
+}